@@ -0,0 +1,397 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+
+/** @file
+ * @brief Compressed on disk archive of clock telemetry
+ *
+ * @author Erez Geva <ErezGeva2@@gmail.com>
+ * @copyright 2021 Erez Geva
+ *
+ */
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "archive.h"
+
+const uint32_t block_magic = 0x4b4c4250; // "PBLK"
+const size_t max_block = 1 << 20; // Samples in block
+
+/* Block header, followed by the time column and the value column */
+struct BlockHead {
+    uint32_t magic;
+    uint32_t count;
+    uint64_t first; // Time of first sample
+    uint64_t min; // Time range of block
+    uint64_t max;
+    uint32_t timeBytes;
+    uint32_t valueBytes;
+};
+
+static inline uint64_t zigzag(int64_t v)
+{
+    return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+static inline int64_t unzigzag(uint64_t v)
+{
+    return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+static inline void putVar(std::vector<uint8_t> &buf, uint64_t v)
+{
+    while(v >= 0x80) {
+        buf.push_back((uint8_t)v | 0x80);
+        v >>= 7;
+    }
+    buf.push_back((uint8_t)v);
+}
+static inline bool getVar(const uint8_t *&cur, const uint8_t *end, uint64_t &v)
+{
+    v = 0;
+    for(int shift = 0; shift < 64 && cur < end; shift += 7) {
+        uint8_t b = *cur++;
+        v |= (uint64_t)(b & 0x7f) << shift;
+        if((b & 0x80) == 0)
+            return true;
+    }
+    return false;
+}
+/* Get block at offset, return its size or 0 if invalid */
+static size_t getBlock(const uint8_t *map, size_t size, size_t off,
+    BlockHead &head)
+{
+    if(size - off < sizeof head)
+        return 0;
+    memcpy(&head, map + off, sizeof head);
+    if(head.magic != block_magic || head.count == 0 ||
+        head.count > max_block)
+        return 0;
+    size_t len = sizeof head + (size_t)head.timeBytes + head.valueBytes;
+    if(size - off < len)
+        return 0;
+    return len;
+}
+SeriesArchive::SeriesArchive() :
+    m_blockSize(1024),
+    m_segmentSize(64 << 20)
+{
+    for(size_t i = 0; i < SERIES_METRICS; i++)
+        m_enabled[i] = true;
+}
+SeriesArchive::~SeriesArchive()
+{
+    close();
+}
+bool SeriesArchive::open(const std::string &dir)
+{
+    if(dir.empty())
+        return false;
+    close();
+    if(mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST)
+        return false;
+    struct stat st;
+    if(stat(dir.c_str(), &st) != 0 || !S_ISDIR(st.st_mode))
+        return false;
+    m_dir = dir;
+    return true;
+}
+void SeriesArchive::close()
+{
+    flush();
+    m_columns.clear();
+    m_dir.clear();
+}
+bool SeriesArchive::setBlockSize(size_t samples)
+{
+    if(samples == 0 || samples > max_block)
+        return false;
+    m_blockSize = samples;
+    return true;
+}
+bool SeriesArchive::setSegmentSize(size_t bytes)
+{
+    if(bytes < sizeof(BlockHead))
+        return false;
+    m_segmentSize = bytes;
+    return true;
+}
+bool SeriesArchive::setMetric(SeriesMetric_e metric, bool enable)
+{
+    if(metric < SERIES_MASTER_OFFSET || metric >= SERIES_METRICS)
+        return false;
+    m_enabled[metric] = enable;
+    return true;
+}
+std::string SeriesArchive::fileName(const ClockIdentity_t &clock,
+    SeriesMetric_e metric) const
+{
+    char name[40];
+    const uint8_t *v = clock.v;
+    snprintf(name, sizeof name, "%02x%02x%02x%02x%02x%02x%02x%02x.%d.",
+        v[0], v[1], v[2], v[3], v[4], v[5], v[6], v[7], metric);
+    return m_dir + "/" + name;
+}
+bool SeriesArchive::check(Column &col)
+{
+    if(col.checked)
+        return true;
+    // Continue the last segment
+    struct stat st;
+    while(stat((col.name + std::to_string(col.segment + 1)).c_str(),
+            &st) == 0)
+        col.segment++;
+    std::string file = col.name + std::to_string(col.segment);
+    int fd = ::open(file.c_str(), O_RDWR);
+    if(fd < 0) {
+        col.checked = errno == ENOENT;
+        return col.checked;
+    }
+    bool ret = false;
+    if(fstat(fd, &st) == 0) {
+        size_t size = st.st_size;
+        size_t end = 0;
+        if(size > 0) {
+            void *map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if(map != MAP_FAILED) {
+                BlockHead head;
+                size_t len;
+                while((len = getBlock((const uint8_t *)map, size, end,
+                                head)) > 0)
+                    end += len;
+                munmap(map, size);
+            } else
+                end = SIZE_MAX;
+        }
+        // Drop a block that was not fully written
+        ret = end == size || (end < size && ftruncate(fd, end) == 0);
+    }
+    ::close(fd);
+    col.checked = ret;
+    return ret;
+}
+bool SeriesArchive::write(Column &col)
+{
+    size_t count = col.times.size();
+    if(count == 0)
+        return true;
+    if(!check(col))
+        return false;
+    std::vector<uint8_t> buf(sizeof(BlockHead));
+    BlockHead head;
+    head.magic = block_magic;
+    head.count = count;
+    head.first = col.times[0];
+    head.min = head.first;
+    head.max = head.first;
+    int64_t delta = 0;
+    for(size_t i = 1; i < count; i++) {
+        uint64_t t = col.times[i];
+        if(t < head.min)
+            head.min = t;
+        if(t > head.max)
+            head.max = t;
+        int64_t d = (int64_t)(t - col.times[i - 1]);
+        putVar(buf, zigzag(d - delta));
+        delta = d;
+    }
+    head.timeBytes = buf.size() - sizeof head;
+    putVar(buf, zigzag(col.values[0]));
+    for(size_t i = 1; i < count; i++)
+        putVar(buf, zigzag((int64_t)((uint64_t)col.values[i] -
+                    (uint64_t)col.values[i - 1])));
+    head.valueBytes = buf.size() - sizeof head - head.timeBytes;
+    memcpy(buf.data(), &head, sizeof head);
+    std::string file = col.name + std::to_string(col.segment);
+    int fd = ::open(file.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if(fd < 0)
+        return false;
+    struct stat st;
+    if(fstat(fd, &st) == 0 && st.st_size > 0 &&
+        (size_t)st.st_size + buf.size() > m_segmentSize) {
+        ::close(fd);
+        col.segment++;
+        file = col.name + std::to_string(col.segment);
+        fd = ::open(file.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+        if(fd < 0)
+            return false;
+    }
+    const uint8_t *cur = buf.data();
+    size_t left = buf.size();
+    while(left > 0) {
+        ssize_t ret = ::write(fd, cur, left);
+        if(ret < 0) {
+            if(errno == EINTR)
+                continue;
+            break;
+        }
+        cur += ret;
+        left -= ret;
+    }
+    ::close(fd);
+    if(left > 0) {
+        // Truncate the partial block before next write
+        col.checked = false;
+        return false;
+    }
+    col.times.clear();
+    col.values.clear();
+    return true;
+}
+bool SeriesArchive::append(const ClockIdentity_t &clock,
+    SeriesMetric_e metric, uint64_t time, int64_t value)
+{
+    if(m_dir.empty() || metric < SERIES_MASTER_OFFSET ||
+        metric >= SERIES_METRICS)
+        return false;
+    uint64_t key;
+    memcpy(&key, clock.v, sizeof key);
+    Column &col = m_columns[Key(key, metric)];
+    if(col.name.empty()) {
+        col.name = fileName(clock, metric);
+        col.segment = 0;
+        col.checked = false;
+    }
+    // Keep samples of a failed write for the next block
+    if(col.times.size() >= max_block)
+        return false;
+    col.times.push_back(time);
+    col.values.push_back(value);
+    if(col.times.size() >= m_blockSize)
+        write(col);
+    return true;
+}
+size_t SeriesArchive::sample(const ClockIdentity_t &clock,
+    SeriesMetric_e metric, uint64_t time, int64_t value)
+{
+    if(!m_enabled[metric])
+        return 0;
+    return append(clock, metric, time, value) ? 1 : 0;
+}
+size_t SeriesArchive::feed(const Message &msg, uint64_t time)
+{
+    return feed(msg.getPeer(), msg.getTlvId(), msg.getData(), time);
+}
+size_t SeriesArchive::feed(const PortIdentity_t &peer, mng_vals_e id,
+    const BaseMngTlv *data, uint64_t time)
+{
+    if(data == nullptr)
+        return 0;
+    size_t count = 0;
+    switch(id) {
+        case TIME_STATUS_NP: {
+            const TIME_STATUS_NP_t &d =
+                *static_cast<const TIME_STATUS_NP_t *>(data);
+            count += sample(peer.clockIdentity, SERIES_MASTER_OFFSET, time,
+                    d.master_offset);
+            break;
+        }
+        case CURRENT_DATA_SET: {
+            const CURRENT_DATA_SET_t &d =
+                *static_cast<const CURRENT_DATA_SET_t *>(data);
+            count += sample(peer.clockIdentity, SERIES_OFFSET_FROM_MASTER,
+                    time, d.offsetFromMaster.getIntervalInt());
+            count += sample(peer.clockIdentity, SERIES_MEAN_PATH_DELAY, time,
+                    d.meanPathDelay.getIntervalInt());
+            break;
+        }
+        default:
+            break;
+    }
+    return count;
+}
+bool SeriesArchive::flush()
+{
+    bool ret = true;
+    for(auto &it : m_columns) {
+        if(!write(it.second))
+            ret = false;
+    }
+    return ret;
+}
+size_t SeriesArchive::scanFile(const std::string &file, uint64_t from,
+    uint64_t to, ArchiveCallback callback)
+{
+    int fd = ::open(file.c_str(), O_RDONLY);
+    if(fd < 0)
+        return 0;
+    struct stat st;
+    if(fstat(fd, &st) != 0 || st.st_size == 0) {
+        ::close(fd);
+        return 0;
+    }
+    size_t size = st.st_size;
+    void *map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if(map == MAP_FAILED)
+        return 0;
+    madvise(map, size, MADV_SEQUENTIAL);
+    const uint8_t *base = static_cast<const uint8_t *>(map);
+    size_t total = 0;
+    size_t off = 0;
+    BlockHead head;
+    size_t len;
+    while((len = getBlock(base, size, off, head)) > 0) {
+        const uint8_t *cur = base + off + sizeof head;
+        off += len;
+        if(head.max < from || head.min > to)
+            continue;
+        m_times.resize(head.count);
+        m_values.resize(head.count);
+        const uint8_t *end = cur + head.timeBytes;
+        uint64_t t = head.first;
+        int64_t delta = 0;
+        uint64_t v;
+        m_times[0] = t;
+        size_t i;
+        for(i = 1; i < head.count && getVar(cur, end, v); i++) {
+            delta += unzigzag(v);
+            t += delta;
+            m_times[i] = t;
+        }
+        if(i < head.count)
+            break;
+        end = cur + head.valueBytes;
+        int64_t value = 0;
+        for(i = 0; i < head.count && getVar(cur, end, v); i++) {
+            value = (int64_t)((uint64_t)value + unzigzag(v));
+            m_values[i] = value;
+        }
+        if(i < head.count)
+            break;
+        // Keep samples in range
+        size_t n = 0;
+        for(i = 0; i < head.count; i++) {
+            if(m_times[i] >= from && m_times[i] <= to) {
+                m_times[n] = m_times[i];
+                m_values[n] = m_values[i];
+                n++;
+            }
+        }
+        if(n > 0) {
+            callback(m_times.data(), m_values.data(), n);
+            total += n;
+        }
+    }
+    munmap(map, size);
+    return total;
+}
+size_t SeriesArchive::scan(const ClockIdentity_t &clock,
+    SeriesMetric_e metric, uint64_t from, uint64_t to,
+    ArchiveCallback callback)
+{
+    if(m_dir.empty() || !callback || metric < SERIES_MASTER_OFFSET ||
+        metric >= SERIES_METRICS)
+        return 0;
+    std::string name = fileName(clock, metric);
+    size_t total = 0;
+    struct stat st;
+    for(uint32_t segment = 0;; segment++) {
+        std::string file = name + std::to_string(segment);
+        if(stat(file.c_str(), &st) != 0)
+            break;
+        total += scanFile(file, from, to, callback);
+    }
+    return total;
+}
@@ -0,0 +1,151 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+
+/** @file
+ * @brief Compressed on disk archive of clock telemetry
+ *
+ * @author Erez Geva <ErezGeva2@@gmail.com>
+ * @copyright 2021 Erez Geva
+ *
+ */
+
+#ifndef __PMC_ARCHIVE_H
+#define __PMC_ARCHIVE_H
+
+#include <map>
+#include <string>
+#include <vector>
+#include <functional>
+#include "series.h"
+
+/**
+ * Archive scan callback
+ * @param[in] times of samples
+ * @param[in] values of samples
+ * @param[in] count number of samples
+ */
+typedef std::function<void (const uint64_t *times, const int64_t *values,
+        size_t count)> ArchiveCallback;
+
+/**
+ * @brief Compressed on disk archive of clock telemetry
+ * @details
+ *  Append samples of each clock and metric to its own segment files.
+ *  Samples are written in blocks of a time column and a value column.
+ *  Times are stored as delta of delta and values as delta,
+ *  both as zigzag variable length integers.
+ *  A block header holds the block time range, so scans skip
+ *  blocks outside the range without decoding them.
+ *  Segment files are memory mapped for scans.
+ *  File name is the clock ID in hexadecimal, the metric and the segment
+ *  number, separated by dots.
+ * @note the archive is not thread safe.
+ */
+class SeriesArchive
+{
+  private:
+    /* Clock and metric */
+    typedef std::pair<uint64_t, uint32_t> Key;
+    struct Column {
+        std::string name; /* File name without segment number */
+        uint32_t segment; /* Last segment */
+        bool checked; /* Last segment end is checked */
+        std::vector<uint64_t> times; /* Samples not written yet */
+        std::vector<int64_t> values;
+    };
+    std::string m_dir;
+    size_t m_blockSize;
+    size_t m_segmentSize;
+    std::map<Key, Column> m_columns;
+    bool m_enabled[SERIES_METRICS];
+    std::vector<uint64_t> m_times; /* Decoded block */
+    std::vector<int64_t> m_values;
+    std::string fileName(const ClockIdentity_t &clock,
+        SeriesMetric_e metric) const;
+    bool check(Column &col);
+    bool write(Column &col);
+    size_t sample(const ClockIdentity_t &clock, SeriesMetric_e metric,
+        uint64_t time, int64_t value);
+    size_t scanFile(const std::string &file, uint64_t from, uint64_t to,
+        ArchiveCallback callback);
+
+  public:
+    SeriesArchive();
+    ~SeriesArchive();
+    /**
+     * Open archive directory
+     * @param[in] dir archive directory, created if missing
+     * @return true on success
+     */
+    bool open(const std::string &dir);
+    /**
+     * Write samples and close archive
+     */
+    void close();
+    /**
+     * Set number of samples in a block
+     * @param[in] samples in block
+     * @return true if the size is valid
+     */
+    bool setBlockSize(size_t samples);
+    /**
+     * Set maximum size of segment file
+     * @param[in] bytes maximum size, a single block may exceed it
+     * @return true if the size is valid
+     */
+    bool setSegmentSize(size_t bytes);
+    /**
+     * Enable or disable a metric
+     * @param[in] metric to change
+     * @param[in] enable true to archive samples of the metric
+     * @return true if metric is valid
+     * @note all metrics are enabled by default
+     */
+    bool setMetric(SeriesMetric_e metric, bool enable);
+    /**
+     * Append a sample
+     * @param[in] clock ID
+     * @param[in] metric of sample
+     * @param[in] time of sample
+     * @param[in] value of sample
+     * @return true on success
+     * @note the sample is written when its block is full
+     */
+    bool append(const ClockIdentity_t &clock, SeriesMetric_e metric,
+        uint64_t time, int64_t value);
+    /**
+     * Append samples from a parsed message
+     * @param[in] msg parsed reply or notification
+     * @param[in] time of the samples
+     * @return number of samples added
+     */
+    size_t feed(const Message &msg, uint64_t time);
+    /**
+     * Append samples from TIME_STATUS_NP and CURRENT_DATA_SET data
+     * @param[in] peer port that sent the data
+     * @param[in] id management ID
+     * @param[in] data management TLV data
+     * @param[in] time of the samples
+     * @return number of samples added
+     */
+    size_t feed(const PortIdentity_t &peer, mng_vals_e id,
+        const BaseMngTlv *data, uint64_t time);
+    /**
+     * Write all samples
+     * @return true on success
+     */
+    bool flush();
+    /**
+     * Scan written samples
+     * @param[in] clock ID
+     * @param[in] metric of samples
+     * @param[in] from first time
+     * @param[in] to last time
+     * @param[in] callback called with the samples of each block in range
+     * @return number of samples passed to the callback
+     * @note samples that are not written are not scanned
+     */
+    size_t scan(const ClockIdentity_t &clock, SeriesMetric_e metric,
+        uint64_t from, uint64_t to, ArchiveCallback callback);
+};
+
+#endif /*__PMC_ARCHIVE_H*/
@@ -0,0 +1,143 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+
+/** @file
+ * @brief Cache of management replies
+ *
+ * @author Erez Geva <ErezGeva2@@gmail.com>
+ * @copyright 2021 Erez Geva
+ *
+ */
+
+#include <cstring>
+#include "cache.h"
+#include "timer.h"
+
+const uint64_t ttl_config = 60000; // Changed by SET, which invalidates
+const uint64_t ttl_state = 1000;
+
+static inline uint64_t clockKey(const ClockIdentity_t &clock)
+{
+    uint64_t key;
+    memcpy(&key, clock.v, sizeof(key));
+    return key;
+}
+bool TransCache::Key::operator<(const Key &other) const
+{
+    // Keep entries of a clock together
+    if(clock != other.clock)
+        return clock < other.clock;
+    if(port != other.port)
+        return port < other.port;
+    if(domain != other.domain)
+        return domain < other.domain;
+    return id < other.id;
+}
+TransCache::TransCache() :
+    m_ttl(LAST_MNG_ID + 1, 0),
+    m_stats{0}
+{
+    for(int i = FIRST_MNG_ID; i <= LAST_MNG_ID; i++) {
+        mng_vals_e id = (mng_vals_e)i;
+        if(Message::isEmpty(id) || !Message::isActionSupported(id, GET))
+            continue;
+        m_ttl[id] = Message::isActionSupported(id, SET) ? ttl_config :
+            ttl_state;
+    }
+    // Description and capabilities do not change at run time
+    for(mng_vals_e id : {CLOCK_DESCRIPTION, DEFAULT_DATA_SET,
+                PORT_PROPERTIES_NP, UNICAST_MASTER_MAX_TABLE_SIZE,
+                ACCEPTABLE_MASTER_MAX_TABLE_SIZE,
+                ALTERNATE_TIME_OFFSET_MAX_KEY,
+                TRANSPARENT_CLOCK_DEFAULT_DATA_SET
+            })
+        m_ttl[id] = ttl_config;
+    m_ttl[TIME] = 0;
+}
+bool TransCache::setTtl(mng_vals_e id, uint64_t ttl_ms)
+{
+    if(id < FIRST_MNG_ID || id > LAST_MNG_ID)
+        return false;
+    m_ttl[id] = ttl_ms;
+    return true;
+}
+uint64_t TransCache::getTtl(mng_vals_e id) const
+{
+    if(id < FIRST_MNG_ID || id > LAST_MNG_ID)
+        return 0;
+    return m_ttl[id];
+}
+TransCache::Key TransCache::key(const PortIdentity_t &target, mng_vals_e id,
+    uint8_t domain) const
+{
+    Key key = {
+        .clock = clockKey(target.clockIdentity),
+        // Ports of a clock share the clock data
+        .port = Message::isClockScope(id) ? (uint16_t)0 : target.portNumber,
+        .domain = domain,
+        .id = id
+    };
+    return key;
+}
+const std::vector<uint8_t> *TransCache::find(const PortIdentity_t &target,
+    mng_vals_e id, uint8_t domain)
+{
+    if(getTtl(id) == 0)
+        return nullptr;
+    auto it = m_entries.find(key(target, id, domain));
+    if(it != m_entries.end()) {
+        if(it->second.expire > nowMs()) {
+            m_stats.hits++;
+            return &it->second.frame;
+        }
+        m_entries.erase(it);
+    }
+    m_stats.misses++;
+    return nullptr;
+}
+void TransCache::store(const PortIdentity_t &target, mng_vals_e id,
+    uint8_t domain, const void *frame, size_t len)
+{
+    uint64_t ttl = getTtl(id);
+    if(ttl == 0)
+        return;
+    Entry &entry = m_entries[key(target, id, domain)];
+    const uint8_t *buf = (const uint8_t *)frame;
+    entry.frame.assign(buf, buf + len);
+    entry.expire = nowMs() + ttl;
+}
+size_t TransCache::invalidate(const ClockIdentity_t &clock)
+{
+    size_t count;
+    uint64_t ck = clockKey(clock);
+    if(ck == UINT64_MAX) {
+        count = m_entries.size();
+        m_entries.clear();
+    } else {
+        Key low = { .clock = ck, .port = 0, .domain = 0,
+                .id = FIRST_MNG_ID
+            };
+        auto first = m_entries.lower_bound(low);
+        auto last = first;
+        count = 0;
+        while(last != m_entries.end() && last->first.clock == ck) {
+            ++last;
+            count++;
+        }
+        m_entries.erase(first, last);
+    }
+    m_stats.invalidations += count;
+    return count;
+}
+size_t TransCache::purge()
+{
+    size_t count = 0;
+    uint64_t now = nowMs();
+    for(auto it = m_entries.begin(); it != m_entries.end();) {
+        if(it->second.expire <= now) {
+            it = m_entries.erase(it);
+            count++;
+        } else
+            ++it;
+    }
+    return count;
+}
@@ -0,0 +1,126 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+
+/** @file
+ * @brief Cache of management replies
+ *
+ * @author Erez Geva <ErezGeva2@@gmail.com>
+ * @copyright 2021 Erez Geva
+ *
+ */
+
+#ifndef __PMC_CACHE_H
+#define __PMC_CACHE_H
+
+#include <map>
+#include <vector>
+#include <cstdint>
+#include "msg.h"
+
+/**
+ * @brief Cache statistics
+ */
+struct TransCacheStats {
+    uint64_t hits; /**< requests replied from the cache */
+    uint64_t misses; /**< cacheable requests sent to the clock */
+    uint64_t invalidations; /**< entries removed by SET or COMMAND */
+};
+
+/**
+ * @brief Cache of GET replies
+ * @details
+ *  Keep GET replies per target port, management ID and domain.
+ *  Each management ID has its own time to live.
+ *  The defaults derive from the management ID properties:
+ *  @li IDs without data or without GET are not cached.
+ *  @li IDs that support SET are configuration and live 60 seconds.
+ *  @li Other IDs are clock state and live 1 second.
+ *  @li Description and capabilities IDs live 60 seconds,
+ *      current time is not cached.
+ *
+ *  Replies of management IDs that apply to the clock are shared
+ *  by all ports of the clock.
+ * @note attach the cache to a transaction engine, the engine invalidates
+ *  entries of a clock when sending SET or COMMAND to it.
+ */
+class TransCache
+{
+  private:
+    struct Key {
+        uint64_t clock;
+        uint16_t port;
+        uint8_t domain;
+        mng_vals_e id;
+        bool operator<(const Key &other) const;
+    };
+    struct Entry {
+        std::vector<uint8_t> frame;
+        uint64_t expire; /* in milliseconds */
+    };
+    std::map<Key, Entry> m_entries;
+    std::vector<uint64_t> m_ttl; /* Time to live of management ID */
+    TransCacheStats m_stats;
+    Key key(const PortIdentity_t &target, mng_vals_e id,
+        uint8_t domain) const;
+
+  public:
+    TransCache();
+    /**
+     * Set time to live of a management ID
+     * @param[in] id management ID
+     * @param[in] ttl_ms time to live in milliseconds, 0 disables cache
+     * @return true if time to live is updated
+     */
+    bool setTtl(mng_vals_e id, uint64_t ttl_ms);
+    /**
+     * Get time to live of a management ID
+     * @param[in] id management ID
+     * @return time to live in milliseconds
+     */
+    uint64_t getTtl(mng_vals_e id) const;
+    /**
+     * Find reply
+     * @param[in] target port
+     * @param[in] id management ID
+     * @param[in] domain number
+     * @return reply message or null if none or expired
+     */
+    const std::vector<uint8_t> *find(const PortIdentity_t &target,
+        mng_vals_e id, uint8_t domain);
+    /**
+     * Store reply
+     * @param[in] target port
+     * @param[in] id management ID
+     * @param[in] domain number
+     * @param[in] frame reply message
+     * @param[in] len reply message length
+     */
+    void store(const PortIdentity_t &target, mng_vals_e id, uint8_t domain,
+        const void *frame, size_t len);
+    /**
+     * Remove replies of a clock
+     * @param[in] clock identity, all ones removes all replies
+     * @return number of replies removed
+     */
+    size_t invalidate(const ClockIdentity_t &clock);
+    /**
+     * Remove expired replies
+     * @return number of replies removed
+     */
+    size_t purge();
+    /**
+     * Remove all replies
+     */
+    void clear() { m_entries.clear(); }
+    /**
+     * Get number of replies
+     * @return number of replies
+     */
+    size_t size() const { return m_entries.size(); }
+    /**
+     * Get statistics
+     * @return statistics
+     */
+    const TransCacheStats &getStats() const { return m_stats; }
+};
+
+#endif /*__PMC_CACHE_H*/
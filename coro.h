@@ -0,0 +1,239 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+
+/** @file
+ * @brief Coroutine management transactions
+ *
+ * @author Erez Geva <ErezGeva2@@gmail.com>
+ * @copyright 2021 Erez Geva
+ *
+ * This header requires C++20, the library itself does not use it.
+ */
+
+#ifndef __PMC_CORO_H
+#define __PMC_CORO_H
+
+#if __cplusplus < 202002L
+#error "coro.h requires C++20"
+#endif
+
+#include <coroutine>
+#include <new>
+#include <exception>
+#include <type_traits>
+#include "trans.h"
+
+/**< @cond internal
+ * Management TLV data type of management ID
+ */
+template<mng_vals_e id> struct TransTlv {
+    typedef BaseMngTlv type; /* Management ID without data */
+};
+#define A(n, v, sc, a, sz, f) case##f(n)
+#define caseUF(n) template<> struct TransTlv<n> { typedef n##_t type; };
+#include "ids.h"
+/**< @endcond */
+
+/**
+ * @brief Result of a coroutine transaction
+ */
+template<typename T> struct TransResult {
+    TransStatus_e status; /**< completion status */
+    /** management error, valid with TRANS_ERROR status */
+    managementErrorId_e error;
+    T data; /**< reply management TLV data, valid with TRANS_OK status */
+    /**
+     * Is request succeeded
+     * @return true if reply received
+     */
+    bool ok() const { return status == TRANS_OK; }
+};
+
+/**
+ * @brief Awaitable transaction
+ * @details
+ *  Send the request when the coroutine suspends and resume it
+ *  when the request completes.
+ *  A request to multiple ports resumes on its deadline with the first reply.
+ * @note created by TransClient
+ */
+template<typename T> class TransAwait
+{
+  private:
+    TransEngine &m_engine;
+    PortIdentity_t m_target;
+    bool m_useTarget;
+    actionField_e m_action;
+    mng_vals_e m_id;
+    BaseMngTlv *m_data;
+    bool m_replied;
+    TransResult<T> m_result;
+    std::coroutine_handle<> m_handle;
+    void done(const TransReply &reply) {
+        if(!m_replied) {
+            m_result.status = reply.status;
+            if(reply.msg != nullptr) {
+                m_replied = true;
+                if(reply.status == TRANS_ERROR)
+                    m_result.error = reply.msg->getErrId();
+                if constexpr(!std::is_same<T, BaseMngTlv>::value) {
+                    // Some TLVs have constant members and can not be assigned
+                    if(reply.data != nullptr) {
+                        m_result.data.~T();
+                        const T *data = static_cast<const T *>(reply.data);
+                        new(&m_result.data) T(*data);
+                    }
+                }
+            }
+        }
+        // Coroutine may end and free this awaitable
+        if(reply.last)
+            m_handle.resume();
+    }
+
+  public:
+    /**< @cond internal */
+    TransAwait(TransEngine &engine, const PortIdentity_t *target,
+        actionField_e action, mng_vals_e id, BaseMngTlv *data) :
+        m_engine(engine), m_target{}, m_useTarget(target != nullptr),
+        m_action(action), m_id(id), m_data(data), m_replied(false),
+        m_result{} {
+        if(m_useTarget)
+            m_target = *target;
+    }
+    bool await_ready() const noexcept { return false; }
+    bool await_suspend(std::coroutine_handle<> handle) {
+        m_handle = handle;
+        TransCallback callback = [this](const TransReply & reply) {
+            done(reply);
+        };
+        int ret;
+        if(m_useTarget) {
+            if(m_data != nullptr)
+                ret = m_engine.request(m_target, m_action, m_id, *m_data,
+                        callback);
+            else
+                ret = m_engine.request(m_target, m_action, m_id, callback);
+        } else if(m_data != nullptr)
+            ret = m_engine.request(m_action, m_id, *m_data, callback);
+        else
+            ret = m_engine.request(m_action, m_id, callback);
+        if(ret < 0) {
+            // Continue the coroutine with the failure
+            m_result.status = TRANS_SEND_ERROR;
+            return false;
+        }
+        return true;
+    }
+    TransResult<T> await_resume() { return std::move(m_result); }
+    /**< @endcond */
+};
+
+/**
+ * @brief Coroutine of a management flow
+ * @details
+ *  The coroutine starts immediately, runs till its first transaction
+ *  and frees itself when it ends.
+ *  Flows run on the transaction engine process() without threads.
+ * @code
+ *  TransTask flow(TransClient &client, const PortIdentity_t &target)
+ *  {
+ *      auto r = co_await client.get<PRIORITY1>(target);
+ *      if(r.ok() && r.data.priority1 != 127) {
+ *          r.data.priority1 = 127;
+ *          co_await client.set<PRIORITY1>(target, r.data);
+ *      }
+ *  }
+ * @endcode
+ * @note exceptions thrown from a flow terminate the program
+ */
+struct TransTask {
+    /**< @cond internal */
+    struct promise_type {
+        TransTask get_return_object() noexcept { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() noexcept {}
+        void unhandled_exception() noexcept { std::terminate(); }
+    };
+    /**< @endcond */
+};
+
+/**
+ * @brief Coroutine management transactions
+ * @details
+ *  Create awaitable transactions on a transaction engine.
+ *  Each awaited transaction holds a single request and its reply data.
+ * @note the client is not thread safe, use it from the engine thread.
+ */
+class TransClient
+{
+  private:
+    TransEngine &m_engine;
+
+  public:
+    /**
+     * Constructor
+     * @param[in] engine used to send requests and receive replies
+     */
+    TransClient(TransEngine &engine) : m_engine(engine) {}
+    /**
+     * Get the transaction engine
+     * @return engine
+     */
+    TransEngine &getEngine() { return m_engine; }
+    /**
+     * Get management TLV of a target
+     * @param[in] target port
+     * @return awaitable with typed result
+     */
+    template<mng_vals_e id>
+    TransAwait<typename TransTlv<id>::type> get(const PortIdentity_t &target)
+    { return {m_engine, &target, GET, id, nullptr}; }
+    /**
+     * Get management TLV of the message target
+     * @return awaitable with typed result
+     */
+    template<mng_vals_e id>
+    TransAwait<typename TransTlv<id>::type> get()
+    { return {m_engine, nullptr, GET, id, nullptr}; }
+    /**
+     * Set management TLV of a target
+     * @param[in] target port
+     * @param[in] data management TLV data
+     * @return awaitable with typed result
+     */
+    template<mng_vals_e id>
+    TransAwait<typename TransTlv<id>::type> set(const PortIdentity_t &target,
+        typename TransTlv<id>::type &data)
+    { return {m_engine, &target, SET, id, &data}; }
+    /**
+     * Set management TLV of the message target
+     * @param[in] data management TLV data
+     * @return awaitable with typed result
+     */
+    template<mng_vals_e id>
+    TransAwait<typename TransTlv<id>::type> set(
+        typename TransTlv<id>::type &data)
+    { return {m_engine, nullptr, SET, id, &data}; }
+    /**
+     * Send command to a target
+     * @param[in] target port
+     * @param[in] id management ID
+     * @return awaitable with result
+     */
+    TransAwait<BaseMngTlv> command(const PortIdentity_t &target,
+        mng_vals_e id)
+    { return {m_engine, &target, COMMAND, id, nullptr}; }
+    /**
+     * Send command with data to a target
+     * @param[in] target port
+     * @param[in] id management ID
+     * @param[in] data management TLV data
+     * @return awaitable with result
+     */
+    TransAwait<BaseMngTlv> command(const PortIdentity_t &target,
+        mng_vals_e id, BaseMngTlv &data)
+    { return {m_engine, &target, COMMAND, id, &data}; }
+};
+
+#endif /*__PMC_CORO_H*/
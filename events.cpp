@@ -0,0 +1,177 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+
+/** @file
+ * @brief Events subscriptions and notifications
+ *
+ * @author Erez Geva <ErezGeva2@@gmail.com>
+ * @copyright 2021 Erez Geva
+ *
+ */
+
+#include <cstring>
+#include "events.h"
+
+const TimerWheel::Handle no_timer = UINT64_MAX;
+
+Subscriber::Subscriber(TransEngine &engine) :
+    m_engine(engine),
+    m_wheel(nowMs()),
+    m_renew(50),
+    m_retry(1000),
+    m_stats{0}
+{
+    m_engine.setNotify([this](const Message & msg) { notify(msg); });
+}
+Subscriber::~Subscriber()
+{
+    m_engine.setNotify(nullptr);
+    for(Sub &sub : m_subs)
+        cancel(sub);
+}
+void Subscriber::cancel(Sub &sub)
+{
+    sub.gen++; // Ignore callback of pending request
+    if(sub.inFlight) {
+        sub.inFlight = false;
+        m_engine.cancel(sub.sequence);
+    }
+}
+bool Subscriber::setRenew(uint32_t percent)
+{
+    if(percent == 0 || percent >= 100)
+        return false;
+    m_renew = percent;
+    return true;
+}
+bool Subscriber::setRetry(uint64_t retry_ms)
+{
+    if(retry_ms == 0)
+        return false;
+    m_retry = retry_ms;
+    return true;
+}
+int Subscriber::subscribe(const PortIdentity_t &target,
+    const SUBSCRIBE_EVENTS_NP_t &events)
+{
+    if(events.duration == 0)
+        return -1;
+    uint32_t idx;
+    if(m_freeSubs.empty()) {
+        if(m_subs.size() >= INT32_MAX)
+            return -1;
+        idx = m_subs.size();
+        m_subs.emplace_back();
+        m_subs[idx].gen = 0;
+    } else {
+        idx = m_freeSubs.back();
+        m_freeSubs.pop_back();
+    }
+    Sub &sub = m_subs[idx];
+    sub.target = target;
+    sub.events = events;
+    sub.timer = no_timer;
+    sub.expire = 0;
+    sub.used = true;
+    sub.inFlight = false;
+    renew(idx);
+    return idx;
+}
+bool Subscriber::unsubscribe(int subId)
+{
+    if(subId < 0 || (size_t)subId >= m_subs.size() || !m_subs[subId].used)
+        return false;
+    Sub &sub = m_subs[subId];
+    m_wheel.cancel(sub.timer);
+    cancel(sub);
+    // Clock removes subscription without events
+    SUBSCRIBE_EVENTS_NP_t events;
+    events.duration = 0;
+    memset(events.bitmask, 0, sizeof(events.bitmask));
+    m_engine.request(sub.target, SET, SUBSCRIBE_EVENTS_NP, events,
+    [](const TransReply &) {});
+    sub.used = false;
+    m_freeSubs.push_back(subId);
+    return true;
+}
+bool Subscriber::isActive(int subId) const
+{
+    if(subId < 0 || (size_t)subId >= m_subs.size() || !m_subs[subId].used)
+        return false;
+    return m_subs[subId].expire > nowMs();
+}
+void Subscriber::renew(uint32_t idx)
+{
+    Sub &sub = m_subs[idx];
+    uint32_t gen = sub.gen;
+    uint64_t sent = nowMs();
+    int ret = m_engine.request(sub.target, SET, SUBSCRIBE_EVENTS_NP,
+            sub.events,
+    [this, idx, gen, sent](const TransReply & reply) {
+        if(m_subs[idx].gen == gen)
+            renewed(idx, reply, sent);
+    });
+    if(ret < 0) {
+        m_stats.failures++;
+        sub.timer = m_wheel.add(sent + m_retry, idx);
+        return;
+    }
+    sub.sequence = ret;
+    sub.inFlight = true;
+    sub.timer = no_timer; // Scheduled on reply
+}
+void Subscriber::renewed(uint32_t idx, const TransReply &reply,
+    uint64_t sent)
+{
+    Sub &sub = m_subs[idx];
+    sub.inFlight = false;
+    uint64_t at;
+    if(reply.status == TRANS_OK) {
+        m_stats.renewals++;
+        uint64_t duration = (uint64_t)sub.events.duration * 1000;
+        // Duration starts when clock receives the request
+        sub.expire = sent + duration;
+        at = sent + duration * m_renew / 100;
+    } else {
+        m_stats.failures++;
+        at = nowMs() + m_retry;
+    }
+    sub.timer = m_wheel.add(at, idx);
+}
+void Subscriber::notify(const Message &msg)
+{
+    const BaseMngTlv *data = msg.getData();
+    if(data != nullptr) {
+        switch(msg.getTlvId()) {
+            case PORT_DATA_SET:
+                m_stats.portState++;
+                if(m_portState)
+                    m_portState(msg.getPeer(),
+                        *static_cast<const PORT_DATA_SET_t *>(data));
+                return;
+            case TIME_STATUS_NP:
+                m_stats.timeSync++;
+                if(m_timeSync)
+                    m_timeSync(msg.getPeer(),
+                        *static_cast<const TIME_STATUS_NP_t *>(data));
+                return;
+            default:
+                break;
+        }
+    }
+    m_stats.unknown++;
+}
+void Subscriber::process(uint64_t timeout_ms)
+{
+    uint64_t end = nowMs() + timeout_ms;
+    for(;;) {
+        uint64_t now = nowMs();
+        m_wheel.advance(now, [this](uint64_t cookie) { renew(cookie); });
+        if(now >= end)
+            break;
+        uint64_t wait = end - now;
+        int64_t next = m_wheel.nextTimeout();
+        if(next > 0 && (uint64_t)next < wait)
+            wait = next;
+        m_engine.process(wait);
+    }
+}
@@ -0,0 +1,156 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+
+/** @file
+ * @brief Events subscriptions and notifications
+ *
+ * @author Erez Geva <ErezGeva2@@gmail.com>
+ * @copyright 2021 Erez Geva
+ *
+ */
+
+#ifndef __PMC_EVENTS_H
+#define __PMC_EVENTS_H
+
+#include <vector>
+#include <cstdint>
+#include "trans.h"
+#include "timer.h"
+
+/**
+ * Port state notification callback
+ * @param[in] peer clock port that sent the notification
+ * @param[in] data port data set
+ */
+typedef std::function<void (const PortIdentity_t &peer,
+    const PORT_DATA_SET_t &data)> PortStateCallback;
+/**
+ * Time synchronization notification callback
+ * @param[in] peer clock port that sent the notification
+ * @param[in] data time status
+ */
+typedef std::function<void (const PortIdentity_t &peer,
+    const TIME_STATUS_NP_t &data)> TimeSyncCallback;
+
+/**
+ * @brief Subscriber statistics
+ */
+struct SubscriberStats {
+    uint64_t renewals; /**< subscriptions renewed */
+    uint64_t failures; /**< renewals without a reply */
+    uint64_t portState; /**< port state notifications */
+    uint64_t timeSync; /**< time synchronization notifications */
+    uint64_t unknown; /**< other unsolicited messages */
+};
+
+/**
+ * @brief Events subscriptions with renewal
+ * @details
+ *  Subscribe to linuxptp events with SUBSCRIBE_EVENTS_NP and renew
+ *  the subscriptions before their duration ends.
+ *  Events notifications arrive as unsolicited PORT_DATA_SET and
+ *  TIME_STATUS_NP responses and are passed to the registered callbacks.
+ * @note the subscriber uses the notify callback of the engine,
+ *  use a single subscriber for each engine.
+ * @note the subscriber is not thread safe, use it from a single thread.
+ */
+class Subscriber
+{
+  private:
+    struct Sub {
+        PortIdentity_t target;
+        SUBSCRIBE_EVENTS_NP_t events;
+        TimerWheel::Handle timer;
+        uint64_t expire; /* Subscription end on the clock */
+        uint32_t gen; /* Generation, detect stale callbacks */
+        uint16_t sequence; /* Of pending request */
+        bool used;
+        bool inFlight;
+    };
+    TransEngine &m_engine;
+    TimerWheel m_wheel;
+    std::vector<Sub> m_subs;
+    std::vector<uint32_t> m_freeSubs;
+    uint32_t m_renew; /* Percent of duration */
+    uint64_t m_retry;
+    PortStateCallback m_portState;
+    TimeSyncCallback m_timeSync;
+    SubscriberStats m_stats;
+    void renew(uint32_t idx);
+    void renewed(uint32_t idx, const TransReply &reply, uint64_t sent);
+    void cancel(Sub &sub);
+    void notify(const Message &msg);
+
+  public:
+    /**
+     * Constructor
+     * @param[in] engine used to send requests and receive notifications
+     */
+    Subscriber(TransEngine &engine);
+    ~Subscriber();
+    /**
+     * Add a subscription
+     * @param[in] target clock port
+     * @param[in] events duration in seconds and bitmask of events
+     * @return subscription ID or negative on failure
+     * @note the subscription is sent immediately
+     */
+    int subscribe(const PortIdentity_t &target,
+        const SUBSCRIBE_EVENTS_NP_t &events);
+    /**
+     * Remove a subscription
+     * @param[in] subId subscription ID
+     * @return true if subscription existed
+     * @note the clock is asked to remove the subscription
+     */
+    bool unsubscribe(int subId);
+    /**
+     * Is subscription active on the clock
+     * @param[in] subId subscription ID
+     * @return true if clock confirmed the subscription and it did not end
+     */
+    bool isActive(int subId) const;
+    /**
+     * Get number of subscriptions
+     * @return number of subscriptions
+     */
+    size_t size() const { return m_subs.size() - m_freeSubs.size(); }
+    /**
+     * Set renewal time
+     * @param[in] percent of the subscription duration
+     * @return true if renewal time is updated
+     */
+    bool setRenew(uint32_t percent);
+    /**
+     * Get renewal time
+     * @return percent of the subscription duration
+     */
+    uint32_t getRenew() const { return m_renew; }
+    /**
+     * Set time to retry a failed renewal
+     * @param[in] retry_ms time in milliseconds
+     * @return true if time is updated
+     */
+    bool setRetry(uint64_t retry_ms);
+    /**
+     * Set port state notification callback
+     * @param[in] callback called on NOTIFY_PORT_STATE events
+     */
+    void onPortState(PortStateCallback callback) { m_portState = callback; }
+    /**
+     * Set time synchronization notification callback
+     * @param[in] callback called on NOTIFY_TIME_SYNC events
+     */
+    void onTimeSync(TimeSyncCallback callback) { m_timeSync = callback; }
+    /**
+     * Renew subscriptions and handle notifications
+     * @param[in] timeout_ms time to process in milliseconds
+     */
+    void process(uint64_t timeout_ms);
+    /**
+     * Get statistics
+     * @return statistics
+     */
+    const SubscriberStats &getStats() const { return m_stats; }
+};
+
+#endif /*__PMC_EVENTS_H*/
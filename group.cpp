@@ -0,0 +1,170 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+
+/** @file
+ * @brief Group of sockets on multiple network interfaces
+ *
+ * @author Erez Geva <ErezGeva2@@gmail.com>
+ * @copyright 2021 Erez Geva
+ *
+ */
+
+#include <cerrno>
+#include <net/if.h>
+#include "sock.h"
+#include "timer.h"
+
+bool SockGroup::setTransport(char transport)
+{
+    if(!m_members.empty())
+        return false;
+    switch(transport) {
+        case '4':
+        case '6':
+        case '2':
+            m_transport = transport;
+            return true;
+        default:
+            return false;
+    }
+}
+bool SockGroup::addIf(const IfInfo &ifObj)
+{
+    if(m_isInit || ifObj.ifIndex() < 0)
+        return false;
+    for(auto &m : m_members) {
+        if(m.ifObj.ifIndex() == ifObj.ifIndex())
+            return false;
+    }
+    SockBaseIf *sock;
+    switch(m_transport) {
+        case '4':
+            sock = new SockIp4;
+            break;
+        case '6':
+            sock = new SockIp6;
+            break;
+        default:
+            sock = new SockRaw;
+            break;
+    }
+    Member m;
+    m.ifObj = ifObj;
+    m.sock.reset(sock);
+    if(!sock->setIf(m.ifObj))
+        return false;
+    m_members.push_back(std::move(m));
+    return true;
+}
+bool SockGroup::addIfUsingName(const std::string &ifName)
+{
+    IfInfo ifObj;
+    return ifObj.initUsingName(ifName) && addIf(ifObj);
+}
+size_t SockGroup::addAllPtp()
+{
+    if(m_isInit)
+        return 0;
+    struct if_nameindex *ifs = if_nameindex();
+    if(ifs == nullptr)
+        return 0;
+    size_t count = 0;
+    for(struct if_nameindex *i = ifs; i->if_index != 0; i++) {
+        IfInfo ifObj;
+        if(ifObj.initUsingIndex(i->if_index) && ifObj.ptpIndex() >= 0 &&
+            addIf(ifObj))
+            count++;
+    }
+    if_freenameindex(ifs);
+    return count;
+}
+SockBaseIf *SockGroup::getSock(size_t index)
+{
+    if(index >= m_members.size())
+        return nullptr;
+    return m_members[index].sock.get();
+}
+const IfInfo *SockGroup::getIf(size_t index) const
+{
+    if(index >= m_members.size())
+        return nullptr;
+    return &m_members[index].ifObj;
+}
+bool SockGroup::init(ConfigFile &cfg)
+{
+    if(m_isInit || m_members.empty())
+        return false;
+    m_pfds.clear();
+    for(auto &m : m_members) {
+        // linuxptp uses the interface name for the port section
+        if(!m.sock->setAll(m.ifObj, cfg, m.ifObj.ifName()) ||
+            !m.sock->init()) {
+            close();
+            return false;
+        }
+        m_pfds.push_back({m.sock->getFd(), POLLIN, 0});
+    }
+    m_next = 0;
+    m_isInit = true;
+    return true;
+}
+bool SockGroup::init()
+{
+    ConfigFile cfg;
+    return init(cfg);
+}
+void SockGroup::close()
+{
+    for(auto &m : m_members)
+        m.sock->close();
+    m_pfds.clear();
+    m_isInit = false;
+}
+bool SockGroup::send(size_t index, const void *msg, size_t len)
+{
+    if(!m_isInit || index >= m_members.size())
+        return false;
+    return m_members[index].sock->send(msg, len);
+}
+size_t SockGroup::sendAll(const void *msg, size_t len)
+{
+    if(!m_isInit)
+        return 0;
+    size_t count = 0;
+    for(auto &m : m_members) {
+        if(m.sock->send(msg, len))
+            count++;
+    }
+    return count;
+}
+ssize_t SockGroup::rcv(void *buf, size_t bufSize, uint64_t timeout_ms)
+{
+    if(!m_isInit)
+        return -1;
+    size_t count = m_pfds.size();
+    uint64_t end = timeout_ms > 0 ? nowMs() + timeout_ms : 0;
+    for(;;) {
+        // Serve sockets found ready by last poll
+        for(size_t i = 0; i < count; i++) {
+            size_t at = (m_next + i) % count;
+            if(m_pfds[at].revents == 0)
+                continue;
+            m_pfds[at].revents = 0;
+            ssize_t cnt = m_members[at].sock->rcv(buf, bufSize, false);
+            if(cnt >= 0) {
+                m_next = at + 1;
+                m_rcvIndex = at;
+                return cnt;
+            }
+        }
+        int wait = -1;
+        if(timeout_ms > 0) {
+            uint64_t now = nowMs();
+            if(now >= end)
+                return -1;
+            wait = end - now;
+        }
+        int ret = ::poll(m_pfds.data(), count, wait);
+        if(ret == 0 || (ret < 0 && errno != EINTR))
+            return -1;
+    }
+}
@@ -0,0 +1,247 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+
+/** @file
+ * @brief In memory socket for benchmarks and tests
+ *
+ * @author Erez Geva <ErezGeva2@@gmail.com>
+ * @copyright 2021 Erez Geva
+ *
+ */
+
+#include <ctime>
+#include <sched.h>
+#include <cerrno>
+#include <atomic>
+#include <climits>
+#include <cstring>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "sock.h"
+
+const size_t cache_line = 64;
+const uint32_t mem_spin_loops = 1000; // Spins before yielding the CPU
+const uint32_t mem_yield_loops = 1000; // Yields before sleeping
+const uint64_t mem_sleep_ms = 10; // Maximum sleep, only a safety net
+
+/* Single producer single consumer ring */
+struct MemRing {
+    std::atomic<uint32_t> head; // Written by producer
+    uint8_t pad1[cache_line - sizeof(std::atomic<uint32_t>)];
+    std::atomic<uint32_t> tail; // Written by consumer
+    uint8_t pad2[cache_line - sizeof(std::atomic<uint32_t>)];
+    std::atomic<uint32_t> waiters; // Consumer sleeps on head
+    std::atomic<bool> closed; // Producer is closed
+    uint32_t mask;
+    size_t slotSize;
+    std::vector<uint8_t> data;
+    std::vector<uint32_t> lens;
+    void init(size_t slots, size_t size) {
+        head.store(0, std::memory_order_relaxed);
+        tail.store(0, std::memory_order_relaxed);
+        waiters.store(0, std::memory_order_relaxed);
+        closed.store(false, std::memory_order_relaxed);
+        mask = slots - 1;
+        slotSize = size;
+        data.resize(slots * size);
+        lens.resize(slots);
+    }
+    bool empty() const {
+        return tail.load(std::memory_order_relaxed) ==
+            head.load(std::memory_order_acquire);
+    }
+};
+static inline void futex(std::atomic<uint32_t> &word, int op, uint32_t val,
+    const timespec *timeout = nullptr)
+{
+    syscall(SYS_futex, &word, op, val, timeout, nullptr, 0);
+}
+/*
+ * Wake a consumer that sleeps on the ring
+ * The fence orders the head store before the waiters load,
+ * the consumer orders its waiters store before the head load.
+ * Either the producer sees the waiter or the consumer sees the head.
+ */
+static inline void wakeRing(MemRing &ring)
+{
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if(ring.waiters.load(std::memory_order_relaxed) > 0)
+        futex(ring.head, FUTEX_WAKE_PRIVATE, INT_MAX);
+}
+/* Side n sends on ring n and receives on the other ring */
+struct SockMem::Link {
+    MemRing ring[2];
+    int fd[2]; // Socket pair, until taken by the sockets
+    Link() : fd{-1, -1} {}
+    ~Link() {
+        for(int i = 0; i < 2; i++) {
+            if(fd[i] >= 0)
+                ::close(fd[i]);
+        }
+    }
+};
+bool SockMem::setRingSize(size_t slots, size_t slotSize)
+{
+    if(m_link || slots < 2 || (slots & (slots - 1)) != 0 ||
+        slotSize == 0 || slotSize > UINT32_MAX)
+        return false;
+    m_slots = slots;
+    m_slotSize = slotSize;
+    return true;
+}
+bool SockMem::setPollable(bool pollable)
+{
+    if(m_link)
+        return false;
+    m_pollable = pollable;
+    return true;
+}
+bool SockMem::connect(SockMem &peer)
+{
+    if(&peer == this || m_isInit || peer.m_isInit)
+        return false;
+    std::shared_ptr<Link> link(new Link);
+    if(m_pollable) {
+        if(socketpair(AF_UNIX, SOCK_DGRAM, 0, link->fd) != 0)
+            return sysErr("socketpair");
+    } else {
+        link->ring[0].init(m_slots, m_slotSize);
+        link->ring[1].init(m_slots, m_slotSize);
+    }
+    m_link = link;
+    m_side = 0;
+    peer.m_link = link;
+    peer.m_side = 1;
+    peer.m_slots = m_slots;
+    peer.m_slotSize = m_slotSize;
+    peer.m_pollable = m_pollable;
+    return true;
+}
+bool SockMem::initBase()
+{
+    if(m_isInit || !m_link)
+        return false;
+    SockBase::closeBase();
+    if(m_pollable) {
+        m_fd = m_link->fd[m_side];
+        if(m_fd < 0)
+            return false;
+        m_link->fd[m_side] = -1;
+    }
+    m_isInit = true;
+    return true;
+}
+void SockMem::closeBase()
+{
+    SockBase::closeBase();
+    if(m_link && !m_pollable) {
+        // Release a peer that waits for our messages
+        MemRing &ring = m_link->ring[m_side];
+        ring.closed.store(true, std::memory_order_release);
+        wakeRing(ring);
+    }
+    m_link.reset();
+    m_isInit = false;
+}
+bool SockMem::sendBase(const void *msg, size_t len)
+{
+    if(!m_isInit)
+        return setErr(SOCK_ERR_NOT_INIT, "send");
+    if(m_pollable)
+        return sendReply(::send(m_fd, msg, len, m_sendFlags), len);
+    MemRing &ring = m_link->ring[m_side];
+    if(len > ring.slotSize) {
+        m_stats.txErrors++;
+        return setErr(SOCK_ERR_SEND_SIZE, "send", len, ring.slotSize);
+    }
+    uint32_t head = ring.head.load(std::memory_order_relaxed);
+    if(head - ring.tail.load(std::memory_order_acquire) > ring.mask)
+        return sendFull();
+    uint32_t idx = head & ring.mask;
+    memcpy(ring.data.data() + idx * ring.slotSize, msg, len);
+    ring.lens[idx] = len;
+    ring.head.store(head + 1, std::memory_order_release);
+    wakeRing(ring);
+    return sendReply(len, len);
+}
+/*
+ * Wait for the ring, timeout zero for blocking
+ * Spin and yield first, then sleep till the producer sends or closes
+ */
+static bool waitRing(MemRing &ring, uint64_t timeout_ms)
+{
+    timespec start;
+    if(timeout_ms > 0)
+        clock_gettime(CLOCK_MONOTONIC, &start);
+    for(uint32_t i = 0; ring.empty(); i++) {
+        // Messages sent before closing are still received
+        if(ring.closed.load(std::memory_order_acquire))
+            return !ring.empty();
+        if(i < mem_spin_loops)
+            continue;
+        uint64_t sleep = mem_sleep_ms;
+        if(timeout_ms > 0) {
+            timespec now;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            uint64_t pass = (now.tv_sec - start.tv_sec) * 1000 +
+                (now.tv_nsec - start.tv_nsec) / 1000000;
+            if(pass >= timeout_ms)
+                return false;
+            if(timeout_ms - pass < sleep)
+                sleep = timeout_ms - pass;
+        }
+        if(i < mem_spin_loops + mem_yield_loops) {
+            sched_yield();
+            continue;
+        }
+        timespec timeout = { 0, (long)sleep * 1000000 };
+        ring.waiters.fetch_add(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        uint32_t head = ring.head.load(std::memory_order_acquire);
+        // The futex returns at once if the producer moved head
+        if(ring.tail.load(std::memory_order_relaxed) == head &&
+            !ring.closed.load(std::memory_order_acquire))
+            futex(ring.head, FUTEX_WAIT_PRIVATE, head, &timeout);
+        ring.waiters.fetch_sub(1, std::memory_order_relaxed);
+    }
+    return true;
+}
+ssize_t SockMem::rcvBase(void *buf, size_t bufSize, bool block)
+{
+    if(!m_isInit) {
+        setErr(SOCK_ERR_NOT_INIT, "rcv");
+        return -1;
+    }
+    if(m_pollable) {
+        ssize_t cnt = recv(m_fd, buf, bufSize, MSG_TRUNC |
+                (block ? 0 : MSG_DONTWAIT));
+        return rcvReply(cnt, bufSize, block);
+    }
+    MemRing &ring = m_link->ring[1 - m_side];
+    if(ring.empty()) {
+        if(!block) {
+            errno = EAGAIN;
+            return rcvReply(-1, bufSize, block);
+        }
+        if(!waitRing(ring, 0)) {
+            m_stats.rxErrors++;
+            setErr(SOCK_ERR_PEER_CLOSED, "rcv");
+            return -1;
+        }
+    }
+    uint32_t tail = ring.tail.load(std::memory_order_relaxed);
+    uint32_t idx = tail & ring.mask;
+    size_t cnt = ring.lens[idx];
+    if(cnt <= bufSize)
+        memcpy(buf, ring.data.data() + idx * ring.slotSize, cnt);
+    ring.tail.store(tail + 1, std::memory_order_release);
+    return rcvReply(cnt, bufSize, block);
+}
+bool SockMem::pollBase(uint64_t timeout_ms) const
+{
+    if(!m_isInit)
+        return false;
+    if(m_pollable)
+        return SockBase::pollBase(timeout_ms);
+    return waitRing(m_link->ring[1 - m_side], timeout_ms);
+}
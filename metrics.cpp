@@ -0,0 +1,359 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+
+/** @file
+ * @brief OpenMetrics exporter of management data
+ *
+ * @author Erez Geva <ErezGeva2@@gmail.com>
+ * @copyright 2021 Erez Geva
+ *
+ */
+
+#include <cerrno>
+#include <cstdio>
+#include <climits>
+#include <cstring>
+#include <algorithm>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include "metrics.h"
+#include "timer.h"
+
+const size_t max_clients = 16;
+const size_t max_request = 8192;
+/* Time to receive a request and send the reply */
+const uint64_t client_timeout_ms = 5000;
+
+enum {
+    FAM_MASTER_OFFSET,
+    FAM_OFFSET_FROM_MASTER,
+    FAM_MEAN_PATH_DELAY,
+    FAM_STEPS_REMOVED,
+    FAM_CLOCK_CLASS,
+    FAM_CLOCK_ACCURACY,
+    FAM_VARIANCE,
+    FAM_PRIORITY1,
+    FAM_PRIORITY2,
+    FAM_GM_CLOCK_CLASS,
+    FAM_PORT_STATE,
+    FAM_PEER_DELAY,
+    FAM_RX_MSG,
+    FAM_TX_MSG,
+    FAM_LAST
+};
+static const struct {
+    const char *name;
+    bool counter;
+    const char *help;
+} families[FAM_LAST] = {
+    { "ptp_master_offset_ns", false, "Offset from source clock" },
+    { "ptp_offset_from_master_ns", false, "Current offset from source clock" },
+    { "ptp_mean_path_delay_ns", false, "Mean path delay" },
+    { "ptp_steps_removed", false, "Steps removed from grand source clock" },
+    { "ptp_clock_class", false, "Clock class" },
+    { "ptp_clock_accuracy", false, "Clock accuracy" },
+    { "ptp_offset_scaled_log_variance", false, "Offset scaled log variance" },
+    { "ptp_priority1", false, "Priority 1" },
+    { "ptp_priority2", false, "Priority 2" },
+    { "ptp_grandmaster_clock_class", false, "Grand source clock class" },
+    { "ptp_port_state", false, "Port state" },
+    { "ptp_peer_mean_path_delay_ns", false, "Peer mean path delay" },
+    { "ptp_rx_messages", true, "Received messages" },
+    { "ptp_tx_messages", true, "Transmitted messages" },
+};
+/* Names of PORT_STATS_NP message types */
+static const char *msgTypes[MAX_MESSAGE_TYPES] = {
+    "sync", "delay_req", "pdelay_req", "pdelay_resp", nullptr, nullptr,
+    nullptr, nullptr, "follow_up", "delay_resp", "pdelay_resp_follow_up",
+    "announce", "signaling", "management", nullptr, nullptr,
+};
+
+MetricsExporter::MetricsExporter() :
+    m_families(FAM_LAST),
+    m_fd(-1),
+    m_scrapes(0)
+{
+    for(size_t i = 0; i < FAM_LAST; i++) {
+        std::string &head = m_families[i].head;
+        head = "# TYPE ";
+        head += families[i].name;
+        head += families[i].counter ? " counter\n# HELP " : " gauge\n# HELP ";
+        head += families[i].name;
+        head += " ";
+        head += families[i].help;
+        head += "\n";
+    }
+}
+MetricsExporter::~MetricsExporter()
+{
+    close();
+}
+void MetricsExporter::set(const PortIdentity_t &port, bool usePort,
+    size_t family, int type, int64_t value)
+{
+    uint64_t clock;
+    memcpy(&clock, port.clockIdentity.v, sizeof clock);
+    uint16_t portNumber = usePort ? port.portNumber : 0;
+    Key key(clock, (uint32_t)portNumber << 16 | family << 8 | type);
+    uint32_t idx;
+    auto it = m_index.find(key);
+    if(it != m_index.end())
+        idx = it->second;
+    else {
+        // Format name and labels once
+        idx = m_series.size();
+        m_series.emplace_back();
+        Series &s = m_series.back();
+        s.line = families[family].name;
+        if(families[family].counter)
+            s.line += "_total";
+        s.line += "{clock=\"" + port.clockIdentity.string() + "\"";
+        if(usePort)
+            s.line += ",port=\"" + std::to_string(portNumber) + "\"";
+        if(families[family].counter) {
+            s.line += ",type=\"";
+            s.line += msgTypes[type];
+            s.line += "\"";
+        }
+        s.line += "} ";
+        s.prefix = s.line.size();
+        m_families[family].series.push_back(idx);
+        m_index[key] = idx;
+    }
+    Series &s = m_series[idx];
+    char buf[24];
+    int len = snprintf(buf, sizeof buf, "%lld\n", (long long)value);
+    s.line.resize(s.prefix);
+    s.line.append(buf, len);
+}
+size_t MetricsExporter::update(const Message &msg)
+{
+    return update(msg.getPeer(), msg.getTlvId(), msg.getData());
+}
+size_t MetricsExporter::update(const PortIdentity_t &peer, mng_vals_e id,
+    const BaseMngTlv *data)
+{
+    if(data == nullptr)
+        return 0;
+    std::lock_guard<std::mutex> lock(m_lock);
+    switch(id) {
+        case TIME_STATUS_NP: {
+            const TIME_STATUS_NP_t &d =
+                *static_cast<const TIME_STATUS_NP_t *>(data);
+            set(peer, false, FAM_MASTER_OFFSET, 0, d.master_offset);
+            return 1;
+        }
+        case CURRENT_DATA_SET: {
+            const CURRENT_DATA_SET_t &d =
+                *static_cast<const CURRENT_DATA_SET_t *>(data);
+            set(peer, false, FAM_OFFSET_FROM_MASTER, 0,
+                d.offsetFromMaster.getIntervalInt());
+            set(peer, false, FAM_MEAN_PATH_DELAY, 0,
+                d.meanPathDelay.getIntervalInt());
+            set(peer, false, FAM_STEPS_REMOVED, 0, d.stepsRemoved);
+            return 3;
+        }
+        case DEFAULT_DATA_SET: {
+            const DEFAULT_DATA_SET_t &d =
+                *static_cast<const DEFAULT_DATA_SET_t *>(data);
+            set(peer, false, FAM_CLOCK_CLASS, 0, d.clockQuality.clockClass);
+            set(peer, false, FAM_CLOCK_ACCURACY, 0,
+                d.clockQuality.clockAccuracy);
+            set(peer, false, FAM_VARIANCE, 0,
+                d.clockQuality.offsetScaledLogVariance);
+            set(peer, false, FAM_PRIORITY1, 0, d.priority1);
+            set(peer, false, FAM_PRIORITY2, 0, d.priority2);
+            return 5;
+        }
+        case PARENT_DATA_SET: {
+            const PARENT_DATA_SET_t &d =
+                *static_cast<const PARENT_DATA_SET_t *>(data);
+            set(peer, false, FAM_GM_CLOCK_CLASS, 0,
+                d.grandmasterClockQuality.clockClass);
+            return 1;
+        }
+        case PORT_DATA_SET: {
+            const PORT_DATA_SET_t &d =
+                *static_cast<const PORT_DATA_SET_t *>(data);
+            set(d.portIdentity, true, FAM_PORT_STATE, 0, d.portState);
+            set(d.portIdentity, true, FAM_PEER_DELAY, 0,
+                d.peerMeanPathDelay.getIntervalInt());
+            return 2;
+        }
+        case PORT_STATS_NP: {
+            const PORT_STATS_NP_t &d =
+                *static_cast<const PORT_STATS_NP_t *>(data);
+            size_t count = 0;
+            for(int i = 0; i < MAX_MESSAGE_TYPES; i++) {
+                if(msgTypes[i] == nullptr)
+                    continue;
+                set(d.portIdentity, true, FAM_RX_MSG, i, d.rxMsgType[i]);
+                set(d.portIdentity, true, FAM_TX_MSG, i, d.txMsgType[i]);
+                count += 2;
+            }
+            return count;
+        }
+        default:
+            return 0;
+    }
+}
+void MetricsExporter::render(std::string &out) const
+{
+    out.clear();
+    std::lock_guard<std::mutex> lock(m_lock);
+    for(const Family &f : m_families) {
+        if(f.series.empty())
+            continue;
+        out += f.head;
+        for(uint32_t idx : f.series)
+            out += m_series[idx].line;
+    }
+    out += "# EOF\n";
+}
+size_t MetricsExporter::size() const
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    return m_series.size();
+}
+void MetricsExporter::clear()
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    m_series.clear();
+    m_index.clear();
+    for(Family &f : m_families)
+        f.series.clear();
+}
+bool MetricsExporter::open(uint16_t port, const std::string &address)
+{
+    close();
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof addr);
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if(inet_pton(AF_INET, address.c_str(), &addr.sin_addr) != 1)
+        return false;
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if(fd < 0)
+        return false;
+    int on = 1;
+    if(setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof on) != 0 ||
+        bind(fd, (sockaddr *)&addr, sizeof addr) != 0 ||
+        listen(fd, max_clients) != 0) {
+        ::close(fd);
+        return false;
+    }
+    m_fd = fd;
+    return true;
+}
+void MetricsExporter::close()
+{
+    for(Client &c : m_clients)
+        ::close(c.fd);
+    m_clients.clear();
+    if(m_fd >= 0) {
+        ::close(m_fd);
+        m_fd = -1;
+    }
+}
+void MetricsExporter::request(Client &client)
+{
+    const char *status;
+    const char *type = "text/plain; charset=utf-8";
+    if(client.in.compare(0, 13, "GET /metrics ") == 0 ||
+        client.in.compare(0, 6, "GET / ") == 0) {
+        status = "200 OK";
+        type = "application/openmetrics-text; version=1.0.0; charset=utf-8";
+        render(m_body);
+        m_scrapes++;
+    } else {
+        status = "404 Not Found";
+        m_body = "Not found\n";
+    }
+    char head[200];
+    int len = snprintf(head, sizeof head, "HTTP/1.1 %s\r\n"
+            "Content-Type: %s\r\nContent-Length: %zu\r\n"
+            "Connection: close\r\n\r\n", status, type, m_body.size());
+    client.out.assign(head, len);
+    client.out += m_body;
+    client.sent = 0;
+}
+bool MetricsExporter::sendOut(Client &client)
+{
+    while(client.sent < client.out.size()) {
+        ssize_t ret = send(client.fd, client.out.data() + client.sent,
+                client.out.size() - client.sent, MSG_NOSIGNAL);
+        if(ret < 0) {
+            if(errno == EINTR)
+                continue;
+            // Keep the connection till the socket is writable
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+        client.sent += ret;
+    }
+    return false; // Response completed
+}
+size_t MetricsExporter::process(uint64_t timeout_ms)
+{
+    if(m_fd < 0)
+        return 0;
+    // Idle clients must not hold the slots
+    uint64_t now = nowMs();
+    uint64_t wait = timeout_ms;
+    for(size_t i = m_clients.size(); i > 0; i--) {
+        Client &c = m_clients[i - 1];
+        if(now - c.accepted >= client_timeout_ms) {
+            ::close(c.fd);
+            m_clients.erase(m_clients.begin() + i - 1);
+        } else
+            wait = std::min(wait, c.accepted + client_timeout_ms - now);
+    }
+    std::vector<pollfd> fds(m_clients.size() + 1);
+    // Leave connections in the backlog while all clients are used
+    fds[0] = { m_fd, (short)(m_clients.size() < max_clients ? POLLIN : 0), 0 };
+    for(size_t i = 0; i < m_clients.size(); i++) {
+        Client &c = m_clients[i];
+        fds[i + 1] = { c.fd, (short)(c.out.empty() ? POLLIN : POLLOUT), 0 };
+    }
+    if(poll(fds.data(), fds.size(), std::min<uint64_t>(wait, INT_MAX)) <= 0)
+        return 0;
+    uint64_t scrapes = m_scrapes;
+    // Handle clients polled, new clients are added at the end
+    for(size_t i = fds.size() - 1; i > 0; i--) {
+        if(fds[i].revents == 0)
+            continue;
+        Client &c = m_clients[i - 1];
+        bool keep = true;
+        if(c.out.empty()) {
+            char buf[1024];
+            ssize_t ret = recv(c.fd, buf, sizeof buf, 0);
+            if(ret > 0) {
+                c.in.append(buf, ret);
+                if(c.in.find("\r\n\r\n") != std::string::npos) {
+                    request(c);
+                    keep = sendOut(c);
+                } else
+                    keep = c.in.size() < max_request;
+            } else
+                keep = ret < 0 && (errno == EAGAIN || errno == EINTR);
+        } else
+            keep = sendOut(c);
+        if(!keep) {
+            ::close(c.fd);
+            m_clients.erase(m_clients.begin() + i - 1);
+        }
+    }
+    if(fds[0].revents & POLLIN) {
+        while(m_clients.size() < max_clients) {
+            int fd = accept4(m_fd, nullptr, nullptr,
+                    SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if(fd < 0)
+                break;
+            m_clients.push_back({fd, nowMs(), std::string(), std::string(),
+                0});
+        }
+    }
+    return m_scrapes - scrapes;
+}
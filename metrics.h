@@ -0,0 +1,130 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+
+/** @file
+ * @brief OpenMetrics exporter of management data
+ *
+ * @author Erez Geva <ErezGeva2@@gmail.com>
+ * @copyright 2021 Erez Geva
+ *
+ */
+
+#ifndef __PMC_METRICS_H
+#define __PMC_METRICS_H
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include "msg.h"
+
+/**
+ * @brief OpenMetrics exporter of management data
+ * @details
+ *  Keep the last value of numeric fields of TIME_STATUS_NP,
+ *  CURRENT_DATA_SET, DEFAULT_DATA_SET, PARENT_DATA_SET, PORT_DATA_SET
+ *  and PORT_STATS_NP replies.
+ *  Each series keeps its text line, with the name and labels formatted
+ *  once, so a scrape only copies the lines.
+ *  Scrapes are served over HTTP from the values of the replies
+ *  and never send management messages.
+ * @note update and the HTTP processing may run on different threads.
+ */
+class MetricsExporter
+{
+  private:
+    struct Series {
+        std::string line; /* Name, labels and value */
+        size_t prefix; /* Length of name and labels */
+    };
+    struct Family {
+        std::string head; /* Type and help */
+        std::vector<uint32_t> series;
+    };
+    struct Client {
+        int fd;
+        uint64_t accepted; /* Accept time in milliseconds */
+        std::string in;
+        std::string out;
+        size_t sent;
+    };
+    /* Clock, port, family and message type */
+    typedef std::pair<uint64_t, uint32_t> Key;
+    mutable std::mutex m_lock;
+    std::vector<Series> m_series;
+    std::vector<Family> m_families;
+    std::map<Key, uint32_t> m_index;
+    int m_fd; /* Listen socket */
+    std::vector<Client> m_clients;
+    std::string m_body; /* Used by HTTP processing */
+    uint64_t m_scrapes;
+    void set(const PortIdentity_t &port, bool usePort, size_t family,
+        int type, int64_t value);
+    void request(Client &client);
+    bool sendOut(Client &client);
+
+  public:
+    MetricsExporter();
+    ~MetricsExporter();
+    /**
+     * Update values from a parsed message
+     * @param[in] msg parsed reply or notification
+     * @return number of values updated
+     */
+    size_t update(const Message &msg);
+    /**
+     * Update values from management TLV data
+     * @param[in] peer port that sent the data
+     * @param[in] id management ID
+     * @param[in] data management TLV data
+     * @return number of values updated
+     */
+    size_t update(const PortIdentity_t &peer, mng_vals_e id,
+        const BaseMngTlv *data);
+    /**
+     * Render all series in OpenMetrics text format
+     * @param[out] out text, the string capacity is reused
+     */
+    void render(std::string &out) const;
+    /**
+     * Get number of series
+     * @return number of series
+     */
+    size_t size() const;
+    /**
+     * Remove all series
+     */
+    void clear();
+    /**
+     * Listen for HTTP scrapes
+     * @param[in] port TCP port
+     * @param[in] address IPv4 address to listen on
+     * @return true on success
+     */
+    bool open(uint16_t port, const std::string &address = "127.0.0.1");
+    /**
+     * Stop listening and close connections
+     */
+    void close();
+    /**
+     * Get listen socket file description
+     * @return file description or -1 if not listening
+     */
+    int getFd() const { return m_fd; }
+    /**
+     * Accept connections and serve scrapes
+     * @param[in] timeout_ms time to wait for connections in milliseconds
+     * @return number of scrapes served
+     * @note sockets do not block, a slow client does not delay others
+     * @note a client that does not complete its request and reply
+     *  within 5 seconds is closed
+     */
+    size_t process(uint64_t timeout_ms = 0);
+    /**
+     * Get number of scrapes served
+     * @return number of scrapes
+     */
+    uint64_t getScrapes() const { return m_scrapes; }
+};
+
+#endif /*__PMC_METRICS_H*/
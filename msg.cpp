@@ -192,20 +192,10 @@ bool Message::checkReplyAction(uint8_t actionField)
 }
 bool Message::allowedAction(mng_vals_e id, actionField_e action)
 {
-    switch(action) {
-        case GET:
-        case SET:
-        case COMMAND:
-            break;
-        default:
-            return false;
-    }
-    if(id < FIRST_MNG_ID || id > LAST_MNG_ID)
+    if(!isActionSupported(id, action))
         return false;
-    if(m_prms.implementSpecific != linuxptp &&
-        mng_all_vals[id].allowed & A_USE_LINUXPTP)
-        return false;
-    return mng_all_vals[id].allowed & (1 << action);
+    return m_prms.implementSpecific == linuxptp ||
+        (mng_all_vals[id].allowed & A_USE_LINUXPTP) == 0;
 }
 Message::Message() :
     m_sendAction(GET),
@@ -280,6 +270,27 @@ bool Message::isEmpty(mng_vals_e id)
         return true;
     return false;
 }
+bool Message::isClockScope(mng_vals_e id)
+{
+    if(id >= FIRST_MNG_ID && id <= LAST_MNG_ID &&
+        mng_all_vals[id].scope == s_clock)
+        return true;
+    return false;
+}
+bool Message::isActionSupported(mng_vals_e id, actionField_e action)
+{
+    switch(action) {
+        case GET:
+        case SET:
+        case COMMAND:
+            break;
+        default:
+            return false;
+    }
+    if(id < FIRST_MNG_ID || id > LAST_MNG_ID)
+        return false;
+    return mng_all_vals[id].allowed & (1 << action);
+}
 
 bool Message::setAction(actionField_e actionField, mng_vals_e tlv_id)
 {
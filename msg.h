@@ -631,7 +631,7 @@ class Message
      * @note the message object holds a single value from the last setting or
      *  reply parsing.
      */
-    mng_vals_e getTlvId() { return m_tlv_id; }
+    mng_vals_e getTlvId() const { return m_tlv_id; }
     /**
      * Set target clock ID to use all clocks.
      */
@@ -763,6 +763,20 @@ class Message
      * @return true if dataField is empty
      */
     static bool isEmpty(mng_vals_e id);
+    /**
+     * Check management TLV id applies to the whole clock
+     * @param[in] id management TLV id
+     * @return true if TLV applies to the clock and not to a port
+     */
+    static bool isClockScope(mng_vals_e id);
+    /**
+     * Check management TLV id supports an action
+     * @param[in] id management TLV id
+     * @param[in] action management action
+     * @return true if action is supported
+     * @note implementation specific TLVs are not checked
+     */
+    static bool isActionSupported(mng_vals_e id, actionField_e action);
     /**
      * Set message object management TLV id and action with empty dataField
      * @param[in] actionField for sending
@@ -0,0 +1,154 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+
+/** @file
+ * @brief Periodic management requests to many clocks
+ *
+ * @author Erez Geva <ErezGeva2@@gmail.com>
+ * @copyright 2021 Erez Geva
+ *
+ */
+
+#include <ctime>
+#include "poller.h"
+
+Poller::Poller(TransEngine &engine) :
+    m_engine(engine),
+    m_wheel(nowMs()),
+    m_jitter(10),
+    m_rand(nowMs()),
+    m_stats{0}
+{
+}
+Poller::~Poller()
+{
+    for(Sub &sub : m_subs)
+        cancel(sub);
+}
+void Poller::cancel(Sub &sub)
+{
+    sub.gen++; // Ignore callback of pending request
+    if(sub.inFlight) {
+        sub.inFlight = false;
+        m_engine.cancel(sub.sequence);
+    }
+}
+bool Poller::setJitter(uint32_t percent)
+{
+    if(percent > 100)
+        return false;
+    m_jitter = percent;
+    return true;
+}
+int Poller::subscribe(const PortIdentity_t &target, mng_vals_e id,
+    uint64_t interval_ms, TransCallback callback)
+{
+    if(interval_ms == 0 || !callback)
+        return -1;
+    uint32_t idx;
+    if(m_freeSubs.empty()) {
+        if(m_subs.size() >= INT32_MAX)
+            return -1;
+        idx = m_subs.size();
+        m_subs.emplace_back();
+        m_subs[idx].gen = 0;
+    } else {
+        idx = m_freeSubs.back();
+        m_freeSubs.pop_back();
+    }
+    Sub &sub = m_subs[idx];
+    if(!m_engine.prepare(sub.frame, target, GET, id)) {
+        m_freeSubs.push_back(idx);
+        return -1;
+    }
+    sub.callback = callback;
+    sub.interval = interval_ms;
+    sub.used = true;
+    sub.inFlight = false;
+    // Spread first requests over the interval
+    sub.base = nowMs() + m_rand() % interval_ms;
+    sub.timer = m_wheel.add(sub.base, idx);
+    return idx;
+}
+bool Poller::unsubscribe(int subId)
+{
+    if(subId < 0 || (size_t)subId >= m_subs.size() || !m_subs[subId].used)
+        return false;
+    Sub &sub = m_subs[subId];
+    m_wheel.cancel(sub.timer);
+    cancel(sub);
+    sub.callback = nullptr;
+    sub.used = false;
+    m_freeSubs.push_back(subId);
+    return true;
+}
+void Poller::schedule(uint32_t idx)
+{
+    Sub &sub = m_subs[idx];
+    uint64_t now = nowMs();
+    sub.base += sub.interval;
+    // Skip periods missed, do not burst to catch up
+    if(sub.base <= now)
+        sub.base = now + sub.interval;
+    uint64_t at = sub.base;
+    uint64_t range = sub.interval * m_jitter / 100;
+    if(range > 0) {
+        // Jitter in [-range, range]
+        uint64_t jitter = m_rand() % (2 * range + 1);
+        at = at + jitter > range ? at + jitter - range : now;
+    }
+    sub.timer = m_wheel.add(at, idx);
+}
+void Poller::due(uint32_t idx)
+{
+    m_stats.due++;
+    schedule(idx);
+    Sub &sub = m_subs[idx];
+    if(sub.inFlight) {
+        m_stats.skipped++;
+        return;
+    }
+    uint32_t gen = sub.gen;
+    int ret = m_engine.request(sub.frame,
+    [this, idx, gen](const TransReply & reply) {
+        if(m_subs[idx].gen != gen)
+            return;
+        if(reply.last)
+            m_subs[idx].inFlight = false;
+        // Callback may change subscriptions
+        TransCallback callback = m_subs[idx].callback;
+        callback(reply);
+    });
+    if(ret < 0)
+        m_stats.sendErrors++;
+    else {
+        sub.sequence = ret;
+        sub.inFlight = true;
+    }
+}
+size_t Poller::process(uint64_t timeout_ms)
+{
+    size_t done = 0;
+    uint64_t end = nowMs() + timeout_ms;
+    for(;;) {
+        uint64_t now = nowMs();
+        m_engine.startBatch();
+        m_wheel.advance(now, [this](uint64_t cookie) { due(cookie); });
+        m_engine.sendBatch();
+        if(now >= end)
+            break;
+        uint64_t wait = end - now;
+        int64_t next = m_wheel.nextTimeout();
+        if(next > 0 && (uint64_t)next < wait)
+            wait = next;
+        if(m_engine.pending() > 0)
+            done += m_engine.process(wait);
+        else {
+            timespec ts = {
+                .tv_sec = (time_t)(wait / 1000),
+                .tv_nsec = (long)(wait % 1000) * 1000000
+            };
+            nanosleep(&ts, nullptr);
+        }
+    }
+    return done;
+}
@@ -0,0 +1,120 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+
+/** @file
+ * @brief Periodic management requests to many clocks
+ *
+ * @author Erez Geva <ErezGeva2@@gmail.com>
+ * @copyright 2021 Erez Geva
+ *
+ */
+
+#ifndef __PMC_POLLER_H
+#define __PMC_POLLER_H
+
+#include <random>
+#include <vector>
+#include <cstdint>
+#include "trans.h"
+#include "timer.h"
+
+/**
+ * @brief Poller statistics
+ */
+struct PollerStats {
+    uint64_t due; /**< subscriptions that were due */
+    /** due subscriptions skipped as their previous request is pending */
+    uint64_t skipped;
+    uint64_t sendErrors; /**< requests failed to send */
+};
+
+/**
+ * @brief Periodic GET requests to many clocks
+ * @details
+ *  Send GET requests of subscriptions, each with a target port,
+ *  management ID and interval. Subscriptions are scheduled with
+ *  a timer wheel, their requests are prepared once and due requests
+ *  are sent in a batch. Schedules are jittered to avoid synchronized
+ *  bursts. Replies are delivered to the subscription callback.
+ * @note use a poller for each socket.
+ * @note the poller is not thread safe, use it from a single thread.
+ */
+class Poller
+{
+  private:
+    struct Sub {
+        TransFrame frame;
+        TransCallback callback;
+        uint64_t interval;
+        uint64_t base; /* Schedule without jitter */
+        TimerWheel::Handle timer;
+        uint32_t gen; /* Generation, detect stale callbacks */
+        uint16_t sequence; /* Of pending request */
+        bool used;
+        bool inFlight;
+    };
+    TransEngine &m_engine;
+    TimerWheel m_wheel;
+    std::vector<Sub> m_subs;
+    std::vector<uint32_t> m_freeSubs;
+    uint32_t m_jitter; /* Percent of interval */
+    std::minstd_rand m_rand;
+    PollerStats m_stats;
+    void schedule(uint32_t idx);
+    void due(uint32_t idx);
+    void cancel(Sub &sub);
+
+  public:
+    /**
+     * Constructor
+     * @param[in] engine used to send requests and receive replies
+     */
+    Poller(TransEngine &engine);
+    ~Poller();
+    /**
+     * Add a subscription
+     * @param[in] target port
+     * @param[in] id management ID
+     * @param[in] interval_ms interval in milliseconds
+     * @param[in] callback called with each reply or request failure
+     * @return subscription ID or negative on failure
+     * @note first request is sent at a random time within the interval
+     */
+    int subscribe(const PortIdentity_t &target, mng_vals_e id,
+        uint64_t interval_ms, TransCallback callback);
+    /**
+     * Remove a subscription
+     * @param[in] subId subscription ID
+     * @return true if subscription existed
+     */
+    bool unsubscribe(int subId);
+    /**
+     * Get number of subscriptions
+     * @return number of subscriptions
+     */
+    size_t size() const { return m_subs.size() - m_freeSubs.size(); }
+    /**
+     * Set schedule jitter
+     * @param[in] percent maximum jitter in percent of the interval
+     * @return true if jitter is updated
+     */
+    bool setJitter(uint32_t percent);
+    /**
+     * Get schedule jitter
+     * @return maximum jitter in percent of the interval
+     */
+    uint32_t getJitter() const { return m_jitter; }
+    /**
+     * Send due requests and handle replies
+     * @param[in] timeout_ms time to process in milliseconds
+     * @return number of requests completed
+     * @note with zero timeout only due requests are sent
+     */
+    size_t process(uint64_t timeout_ms);
+    /**
+     * Get statistics
+     * @return statistics
+     */
+    const PollerStats &getStats() const { return m_stats; }
+};
+
+#endif /*__PMC_POLLER_H*/
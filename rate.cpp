@@ -0,0 +1,65 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+
+/** @file
+ * @brief Token bucket rate limit
+ *
+ * @author Erez Geva <ErezGeva2@@gmail.com>
+ * @copyright 2021 Erez Geva
+ *
+ */
+
+#include <algorithm>
+#include "rate.h"
+
+const uint64_t token = 1000000; // Level of a single token
+
+TokenBucket::TokenBucket(uint64_t rate, uint64_t burst) :
+    m_rate(0), m_burst(0), m_level(0), m_last(0)
+{
+    set(rate, burst);
+}
+bool TokenBucket::set(uint64_t rate, uint64_t burst)
+{
+    if(rate > 0 && (burst == 0 || burst > UINT32_MAX))
+        return false;
+    m_rate = rate;
+    m_burst = burst;
+    m_level = burst * token;
+    m_last = 0;
+    return true;
+}
+void TokenBucket::refill(uint64_t now_us)
+{
+    if(m_last == 0 || now_us < m_last) {
+        m_last = now_us;
+        return;
+    }
+    uint64_t max = m_burst * token;
+    uint64_t elapsed = now_us - m_last;
+    m_last = now_us;
+    // Avoid overflow after a long idle time
+    if(elapsed >= max / m_rate + 1)
+        m_level = max;
+    else
+        m_level = std::min(m_level + elapsed * m_rate, max);
+}
+size_t TokenBucket::take(uint64_t now_us, size_t count)
+{
+    if(m_rate == 0)
+        return count;
+    refill(now_us);
+    size_t avail = m_level / token;
+    if(count > avail)
+        count = avail;
+    m_level -= count * token;
+    return count;
+}
+uint64_t TokenBucket::wait(uint64_t now_us)
+{
+    if(m_rate == 0)
+        return 0;
+    refill(now_us);
+    if(m_level >= token)
+        return 0;
+    return (token - m_level + m_rate - 1) / m_rate;
+}
@@ -0,0 +1,78 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+
+/** @file
+ * @brief Token bucket rate limit
+ *
+ * @author Erez Geva <ErezGeva2@@gmail.com>
+ * @copyright 2021 Erez Geva
+ *
+ */
+
+#ifndef __PMC_RATE_H
+#define __PMC_RATE_H
+
+#include <cstdint>
+#include <cstddef>
+
+/**
+ * @brief Token bucket rate limit
+ * @details
+ *  The bucket holds up to burst tokens and is refilled with rate
+ *  tokens per second. Each message takes a token.
+ *  A bucket with zero rate is not limited.
+ * @note the bucket is not thread safe.
+ */
+class TokenBucket
+{
+  private:
+    uint64_t m_rate; /* Tokens per second */
+    uint64_t m_burst;
+    uint64_t m_level; /* In millionths of token */
+    uint64_t m_last; /* Last refill in microseconds */
+    void refill(uint64_t now_us);
+
+  public:
+    /**
+     * Constructor
+     * @param[in] rate tokens per second, zero for no limit
+     * @param[in] burst maximum number of tokens
+     */
+    TokenBucket(uint64_t rate = 0, uint64_t burst = 0);
+    /**
+     * Set limit, the bucket is filled
+     * @param[in] rate tokens per second, zero for no limit
+     * @param[in] burst maximum number of tokens
+     * @return true if limit is updated
+     */
+    bool set(uint64_t rate, uint64_t burst);
+    /**
+     * Is bucket limited
+     * @return true if rate is not zero
+     */
+    bool isLimited() const { return m_rate > 0; }
+    /**
+     * Get rate
+     * @return tokens per second
+     */
+    uint64_t getRate() const { return m_rate; }
+    /**
+     * Get burst
+     * @return maximum number of tokens
+     */
+    uint64_t getBurst() const { return m_burst; }
+    /**
+     * Take tokens
+     * @param[in] now_us current monotonic time in microseconds
+     * @param[in] count number of tokens to take
+     * @return number of tokens taken
+     */
+    size_t take(uint64_t now_us, size_t count = 1);
+    /**
+     * Get time till a token is available
+     * @param[in] now_us current monotonic time in microseconds
+     * @return microseconds, zero if a token is available
+     */
+    uint64_t wait(uint64_t now_us);
+};
+
+#endif /*__PMC_RATE_H*/
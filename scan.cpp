@@ -0,0 +1,150 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+
+/** @file
+ * @brief Scan of PTP domains
+ *
+ * @author Erez Geva <ErezGeva2@@gmail.com>
+ * @copyright 2021 Erez Geva
+ *
+ */
+
+#include <cstring>
+#include "scan.h"
+
+const size_t ptp_major_sdo_offset = 0; /* Upper nibble */
+const size_t ptp_domain_offset = 4;
+const size_t ptp_minor_sdo_offset = 5;
+const uint16_t max_sdo_id = 0xfff;
+/* Keep sequences of the engine for other requests */
+const size_t max_scan_requests = 16384;
+
+DomainScan::DomainScan(TransEngine &engine) :
+    m_engine(engine),
+    m_id(NULL_PTP_MANAGEMENT),
+    m_firstDomain(0),
+    m_lastDomain(127),
+    m_firstSdoId(0),
+    m_lastSdoId(0),
+    m_outstanding(0),
+    m_stats{0}
+{
+}
+bool DomainScan::setId(mng_vals_e id)
+{
+    if(m_outstanding > 0 || (id != NULL_PTP_MANAGEMENT &&
+            id != DEFAULT_DATA_SET))
+        return false;
+    m_id = id;
+    return true;
+}
+bool DomainScan::setDomains(uint8_t first, uint8_t last)
+{
+    if(m_outstanding > 0 || first > last)
+        return false;
+    m_firstDomain = first;
+    m_lastDomain = last;
+    return true;
+}
+bool DomainScan::setSdoIds(uint16_t first, uint16_t last)
+{
+    if(m_outstanding > 0 || first > last || last > max_sdo_id)
+        return false;
+    m_firstSdoId = first;
+    m_lastSdoId = last;
+    return true;
+}
+bool DomainScan::build()
+{
+    size_t domains = m_lastDomain - m_firstDomain + 1;
+    size_t count = domains * (m_lastSdoId - m_firstSdoId + 1);
+    if(count > max_scan_requests)
+        return false;
+    PortIdentity_t all;
+    memset(all.clockIdentity.v, 0xff, all.clockIdentity.size());
+    all.portNumber = UINT16_MAX;
+    TransFrame base;
+    if(!m_engine.prepare(base, all, GET, m_id))
+        return false;
+    // Only the header changes, the batch keeps pointers to the frames
+    m_frames.assign(count, base);
+    for(size_t i = 0; i < count; i++) {
+        uint8_t *buf = m_frames[i].frame.data();
+        uint16_t sdoId = m_firstSdoId + i / domains;
+        buf[ptp_major_sdo_offset] = (buf[ptp_major_sdo_offset] & 0xf) |
+            ((sdoId >> 4) & 0xf0);
+        buf[ptp_domain_offset] = m_firstDomain + i % domains;
+        buf[ptp_minor_sdo_offset] = sdoId & UINT8_MAX;
+    }
+    return true;
+}
+bool DomainScan::scan()
+{
+    if(m_outstanding > 0 || !build())
+        return false;
+    m_domains.clear();
+    size_t count = 0;
+    m_engine.startBatch();
+    for(TransFrame &frame : m_frames) {
+        const uint8_t *buf = frame.frame.data();
+        ScanDomain domain;
+        domain.sdoId = ((buf[ptp_major_sdo_offset] & 0xf0) << 4) |
+            buf[ptp_minor_sdo_offset];
+        domain.domainNumber = buf[ptp_domain_offset];
+        int ret = m_engine.request(frame,
+        [this, domain](const TransReply & reply) {
+            this->reply(reply, domain);
+        });
+        if(ret >= 0)
+            count++;
+    }
+    // Failed requests complete in sendBatch()
+    m_outstanding += count;
+    m_stats.requests += count;
+    m_engine.sendBatch();
+    if(m_outstanding == 0)
+        return false;
+    m_stats.scans++;
+    return true;
+}
+void DomainScan::reply(const TransReply &reply, const ScanDomain &domain)
+{
+    // Error replies count, clock may not support the ID
+    if(reply.msg != nullptr) {
+        m_stats.replies++;
+        ScanDomain key;
+        key.sdoId = reply.msg->getSdoId();
+        key.domainNumber = reply.msg->getDomainNumber();
+        if(key.sdoId != domain.sdoId ||
+            key.domainNumber != domain.domainNumber)
+            m_stats.mismatched++;
+        const PortIdentity_t &peer = reply.msg->getPeer();
+        std::vector<ScanClock> &clocks = m_domains[key];
+        ScanClock *clock = nullptr;
+        for(ScanClock &c : clocks) {
+            if(c.port.portNumber == peer.portNumber &&
+                memcmp(c.port.clockIdentity.v, peer.clockIdentity.v,
+                    peer.clockIdentity.size()) == 0) {
+                clock = &c;
+                break;
+            }
+        }
+        if(clock == nullptr) {
+            clocks.emplace_back();
+            clock = &clocks.back();
+            clock->port = peer;
+            clock->hasDefault = false;
+        }
+        if(reply.status == TRANS_OK && reply.data != nullptr &&
+            reply.id == DEFAULT_DATA_SET) {
+            const DEFAULT_DATA_SET_t &d =
+                *static_cast<const DEFAULT_DATA_SET_t *>(reply.data);
+            clock->numberPorts = d.numberPorts;
+            clock->priority1 = d.priority1;
+            clock->priority2 = d.priority2;
+            clock->clockQuality = d.clockQuality;
+            clock->hasDefault = true;
+        }
+    }
+    if(reply.last)
+        m_outstanding--;
+}
@@ -0,0 +1,150 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+
+/** @file
+ * @brief Scan of PTP domains
+ *
+ * @author Erez Geva <ErezGeva2@@gmail.com>
+ * @copyright 2021 Erez Geva
+ *
+ */
+
+#ifndef __PMC_SCAN_H
+#define __PMC_SCAN_H
+
+#include <map>
+#include <vector>
+#include <cstdint>
+#include "trans.h"
+
+/**
+ * @brief Domain in a scan
+ */
+struct ScanDomain {
+    uint16_t sdoId; /**< sdoId, was transportSpecific */
+    uint8_t domainNumber; /**< domain number */
+    /**
+     * Compare domains
+     * @param[in] other domain
+     * @return true if domain is before other
+     */
+    bool operator<(const ScanDomain &other) const {
+        return sdoId != other.sdoId ? sdoId < other.sdoId :
+            domainNumber < other.domainNumber;
+    }
+};
+
+/**
+ * @brief Clock found by a scan
+ */
+struct ScanClock {
+    PortIdentity_t port; /**< port that replied */
+    bool hasDefault; /**< DEFAULT_DATA_SET received */
+    /* From DEFAULT_DATA_SET */
+    UInteger16_t numberPorts; /**< number of ports */
+    UInteger8_t priority1; /**< priority 1 */
+    UInteger8_t priority2; /**< priority 2 */
+    ClockQuality_t clockQuality; /**< clock quality */
+};
+
+/**
+ * @brief Scan statistics
+ */
+struct ScanStats {
+    uint64_t scans; /**< scans started */
+    uint64_t requests; /**< requests started */
+    uint64_t replies; /**< replies received */
+    /** replies with another domain or sdoId than the request */
+    uint64_t mismatched;
+};
+
+/**
+ * @brief Scan of PTP domains
+ * @details
+ *  Find the clocks of each domain and sdoId in a range.
+ *  A request of all clocks is prepared once for each domain and sdoId,
+ *  all requests are sent in a single batch, and they end together
+ *  when the engine timeout passes.
+ *  Replies are sorted by the domain and sdoId of the reply header.
+ * @note the scan is not thread safe, use it from the engine thread.
+ */
+class DomainScan
+{
+  private:
+    TransEngine &m_engine;
+    mng_vals_e m_id;
+    uint8_t m_firstDomain;
+    uint8_t m_lastDomain;
+    uint16_t m_firstSdoId;
+    uint16_t m_lastSdoId;
+    std::vector<TransFrame> m_frames; /* Request of each domain and sdoId */
+    std::map<ScanDomain, std::vector<ScanClock>> m_domains;
+    size_t m_outstanding; /* Requests of current scan */
+    ScanStats m_stats;
+    bool build();
+    void reply(const TransReply &reply, const ScanDomain &domain);
+
+  public:
+    /**
+     * Constructor
+     * @param[in] engine used to send requests and receive replies
+     * @note by default scan domains 0 to 127 with sdoId 0
+     *  using NULL_PTP_MANAGEMENT.
+     */
+    DomainScan(TransEngine &engine);
+    /**
+     * Set management ID to query
+     * @param[in] id NULL_PTP_MANAGEMENT or DEFAULT_DATA_SET
+     * @return true if ID is updated
+     */
+    bool setId(mng_vals_e id);
+    /**
+     * Set range of domains
+     * @param[in] first domain number
+     * @param[in] last domain number
+     * @return true if range is updated
+     */
+    bool setDomains(uint8_t first, uint8_t last);
+    /**
+     * Set range of sdoIds
+     * @param[in] first sdoId
+     * @param[in] last sdoId
+     * @return true if range is updated
+     * @note sdoId is 12 bits, the upper 4 bits were transportSpecific.
+     */
+    bool setSdoIds(uint16_t first, uint16_t last);
+    /**
+     * Start a scan
+     * @return true if requests are sent
+     * @note a scan sends at most 16384 requests, the number of domains
+     *  times the number of sdoIds.
+     * @note results of the previous scan are removed.
+     * @note requests are prepared with the engine message parameters,
+     *  only the domain and the sdoId change.
+     */
+    bool scan();
+    /**
+     * Is scan running
+     * @return true if requests are pending
+     */
+    bool isRunning() const { return m_outstanding > 0; }
+    /**
+     * Process until scan ends
+     */
+    void run() {
+        while(m_outstanding > 0)
+            m_engine.process();
+    }
+    /**
+     * Get clocks of each domain
+     * @return clocks by domain and sdoId, only domains with clocks
+     */
+    const std::map<ScanDomain, std::vector<ScanClock>> &getDomains() const
+    { return m_domains; }
+    /**
+     * Get statistics
+     * @return statistics
+     */
+    const ScanStats &getStats() const { return m_stats; }
+};
+
+#endif /*__PMC_SCAN_H*/
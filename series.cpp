@@ -0,0 +1,217 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+
+/** @file
+ * @brief Time series of clock telemetry
+ *
+ * @author Erez Geva <ErezGeva2@@gmail.com>
+ * @copyright 2021 Erez Geva
+ *
+ */
+
+#include <new>
+#include <cstdlib>
+#include <cstring>
+#include "series.h"
+
+const size_t cache_line = 64;
+
+static inline uint64_t clockKey(const ClockIdentity_t &clock)
+{
+    uint64_t key;
+    memcpy(&key, clock.v, sizeof(key));
+    return key;
+}
+TimeSeries::TimeSeries(const PortIdentity_t &port, SeriesMetric_e metric,
+    size_t capacity) :
+    m_port(port),
+    m_metric(metric),
+    m_mask(0),
+    m_mem(nullptr)
+{
+    size_t slots = 2;
+    while(slots < capacity)
+        slots <<= 1;
+    // Head on its own cache line, followed by the times and the values
+    size_t times = slots * sizeof(std::atomic<uint64_t>);
+    size_t size = cache_line + times + slots * sizeof(std::atomic<int64_t>);
+    if(posix_memalign(&m_mem, cache_line, size) != 0) {
+        m_mem = nullptr;
+        // Keep count() valid
+        m_head = new std::atomic<uint64_t>(0);
+        return;
+    }
+    uint8_t *mem = static_cast<uint8_t *>(m_mem);
+    m_head = new(mem) std::atomic<uint64_t>(0);
+    m_times = new(mem + cache_line) std::atomic<uint64_t>[slots];
+    m_values = new(mem + cache_line + times) std::atomic<int64_t>[slots];
+    for(size_t i = 0; i < slots; i++) {
+        m_times[i].store(0, std::memory_order_relaxed);
+        m_values[i].store(0, std::memory_order_relaxed);
+    }
+    m_mask = slots - 1;
+}
+TimeSeries::~TimeSeries()
+{
+    if(m_mem == nullptr)
+        delete m_head;
+    else
+        free(m_mem);
+}
+void TimeSeries::push(uint64_t time, int64_t value)
+{
+    if(m_mem == nullptr)
+        return;
+    uint64_t head = m_head->load(std::memory_order_relaxed);
+    // Readers that see the new sample also see the previous head
+    std::atomic_thread_fence(std::memory_order_release);
+    size_t i = head & m_mask;
+    m_times[i].store(time, std::memory_order_relaxed);
+    m_values[i].store(value, std::memory_order_relaxed);
+    m_head->store(head + 1, std::memory_order_release);
+}
+size_t TimeSeries::read(uint64_t *times, int64_t *values, size_t count) const
+{
+    if(m_mem == nullptr || times == nullptr || values == nullptr)
+        return 0;
+    uint64_t head = m_head->load(std::memory_order_acquire);
+    // The writer may be overwriting the slot after the last sample
+    uint64_t num = head;
+    if(num > m_mask)
+        num = m_mask;
+    if(num > count)
+        num = count;
+    uint64_t first = head - num;
+    for(uint64_t i = 0; i < num; i++) {
+        size_t j = (first + i) & m_mask;
+        times[i] = m_times[j].load(std::memory_order_relaxed);
+        values[i] = m_values[j].load(std::memory_order_relaxed);
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    uint64_t last = m_head->load(std::memory_order_relaxed);
+    // The writer may be overwriting the sample after the last one
+    uint64_t valid = last > m_mask ? last - m_mask : 0;
+    if(first < valid) {
+        uint64_t skip = valid - first;
+        if(skip >= num)
+            return 0;
+        num -= skip;
+        memmove(times, times + skip, num * sizeof(uint64_t));
+        memmove(values, values + skip, num * sizeof(int64_t));
+    }
+    return num;
+}
+SeriesStore::SeriesStore(size_t maxSeries, size_t capacity) :
+    m_capacity(capacity),
+    m_maxSeries(maxSeries),
+    m_series(new TimeSeries *[maxSeries]),
+    m_size(0)
+{
+    for(size_t i = 0; i < SERIES_METRICS; i++)
+        m_enabled[i] = true;
+}
+SeriesStore::~SeriesStore()
+{
+    size_t size = m_size.load(std::memory_order_relaxed);
+    for(size_t i = 0; i < size; i++)
+        delete m_series[i];
+}
+bool SeriesStore::setMetric(SeriesMetric_e metric, bool enable)
+{
+    if(metric < SERIES_MASTER_OFFSET || metric >= SERIES_METRICS)
+        return false;
+    m_enabled[metric] = enable;
+    return true;
+}
+size_t SeriesStore::sample(const PortIdentity_t &port,
+    SeriesMetric_e metric, uint64_t time, int64_t value)
+{
+    if(!m_enabled[metric])
+        return 0;
+    Key key(clockKey(port.clockIdentity),
+        (uint32_t)port.portNumber << 16 | metric);
+    TimeSeries *series;
+    auto it = m_index.find(key);
+    if(it != m_index.end())
+        series = it->second;
+    else {
+        size_t size = m_size.load(std::memory_order_relaxed);
+        if(size >= m_maxSeries)
+            return 0;
+        series = new TimeSeries(port, metric, m_capacity);
+        if(series->capacity() == 0) {
+            delete series;
+            return 0;
+        }
+        m_series[size] = series;
+        m_size.store(size + 1, std::memory_order_release);
+        m_index[key] = series;
+    }
+    series->push(time, value);
+    return 1;
+}
+size_t SeriesStore::feed(const Message &msg, uint64_t time)
+{
+    return feed(msg.getPeer(), msg.getTlvId(), msg.getData(), time);
+}
+size_t SeriesStore::feed(const PortIdentity_t &peer, mng_vals_e id,
+    const BaseMngTlv *data, uint64_t time)
+{
+    if(data == nullptr)
+        return 0;
+    size_t count = 0;
+    PortIdentity_t port = peer;
+    switch(id) {
+        case TIME_STATUS_NP: {
+            const TIME_STATUS_NP_t &d =
+                *static_cast<const TIME_STATUS_NP_t *>(data);
+            port.portNumber = 0;
+            count += sample(port, SERIES_MASTER_OFFSET, time, d.master_offset);
+            break;
+        }
+        case CURRENT_DATA_SET: {
+            const CURRENT_DATA_SET_t &d =
+                *static_cast<const CURRENT_DATA_SET_t *>(data);
+            port.portNumber = 0;
+            count += sample(port, SERIES_OFFSET_FROM_MASTER, time,
+                    d.offsetFromMaster.getIntervalInt());
+            count += sample(port, SERIES_MEAN_PATH_DELAY, time,
+                    d.meanPathDelay.getIntervalInt());
+            break;
+        }
+        case PORT_STATS_NP: {
+            const PORT_STATS_NP_t &d =
+                *static_cast<const PORT_STATS_NP_t *>(data);
+            port = d.portIdentity;
+            for(int i = 0; i < MAX_MESSAGE_TYPES; i++) {
+                count += sample(port, (SeriesMetric_e)(SERIES_RX_MSG + i),
+                        time, d.rxMsgType[i]);
+                count += sample(port, (SeriesMetric_e)(SERIES_TX_MSG + i),
+                        time, d.txMsgType[i]);
+            }
+            break;
+        }
+        default:
+            break;
+    }
+    return count;
+}
+const TimeSeries *SeriesStore::get(size_t index) const
+{
+    if(index >= m_size.load(std::memory_order_acquire))
+        return nullptr;
+    return m_series[index];
+}
+const TimeSeries *SeriesStore::find(const PortIdentity_t &port,
+    SeriesMetric_e metric) const
+{
+    size_t size = m_size.load(std::memory_order_acquire);
+    for(size_t i = 0; i < size; i++) {
+        const TimeSeries *series = m_series[i];
+        const PortIdentity_t &sp = series->getPort();
+        if(series->getMetric() == metric && sp.portNumber == port.portNumber &&
+            memcmp(sp.clockIdentity.v, port.clockIdentity.v,
+                port.clockIdentity.size()) == 0)
+            return series;
+    }
+    return nullptr;
+}
@@ -0,0 +1,189 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+
+/** @file
+ * @brief Time series of clock telemetry
+ *
+ * @author Erez Geva <ErezGeva2@@gmail.com>
+ * @copyright 2021 Erez Geva
+ *
+ */
+
+#ifndef __PMC_SERIES_H
+#define __PMC_SERIES_H
+
+#include <map>
+#include <atomic>
+#include <memory>
+#include <cstdint>
+#include "msg.h"
+
+/** Telemetry metric */
+enum SeriesMetric_e {
+    /** TIME_STATUS_NP master_offset in nanoseconds */
+    SERIES_MASTER_OFFSET,
+    /** CURRENT_DATA_SET offsetFromMaster in nanoseconds */
+    SERIES_OFFSET_FROM_MASTER,
+    /** CURRENT_DATA_SET meanPathDelay in nanoseconds */
+    SERIES_MEAN_PATH_DELAY,
+    /** PORT_STATS_NP rxMsgType, add the message type */
+    SERIES_RX_MSG,
+    /** PORT_STATS_NP txMsgType, add the message type */
+    SERIES_TX_MSG = SERIES_RX_MSG + MAX_MESSAGE_TYPES,
+    /** Number of metrics */
+    SERIES_METRICS = SERIES_TX_MSG + MAX_MESSAGE_TYPES,
+};
+
+/**
+ * @brief Fixed capacity ring of samples
+ * @details
+ *  Times and values are kept in separate cache line aligned arrays.
+ *  A single writer pushes samples, the oldest samples are overwritten.
+ *  Readers copy recent samples without locks, samples that the writer
+ *  overwrote during the copy are dropped, like a sequence lock.
+ */
+class TimeSeries
+{
+  private:
+    PortIdentity_t m_port;
+    SeriesMetric_e m_metric;
+    size_t m_mask;
+    void *m_mem;
+    std::atomic<uint64_t> *m_head; /* Samples written, on own cache line */
+    std::atomic<uint64_t> *m_times;
+    std::atomic<int64_t> *m_values;
+    TimeSeries(const TimeSeries &) = delete;
+    TimeSeries &operator=(const TimeSeries &) = delete;
+
+  public:
+    /**
+     * Constructor
+     * @param[in] port of the clock, port number 0 for clock metrics
+     * @param[in] metric of the series
+     * @param[in] capacity number of slots, rounded up to power of 2
+     * @note one slot is kept for the writer,
+     *  so capacity() is one less than the slots.
+     * @note on allocation failure the capacity is 0
+     */
+    TimeSeries(const PortIdentity_t &port, SeriesMetric_e metric,
+        size_t capacity);
+    ~TimeSeries();
+    /**
+     * Get port of the series
+     * @return port
+     */
+    const PortIdentity_t &getPort() const { return m_port; }
+    /**
+     * Get metric of the series
+     * @return metric
+     */
+    SeriesMetric_e getMetric() const { return m_metric; }
+    /**
+     * Get maximum number of samples read() returns
+     * @return number of samples, one less than the slots
+     */
+    size_t capacity() const { return m_mem == nullptr ? 0 : m_mask; }
+    /**
+     * Get number of samples ever pushed
+     * @return number of samples
+     */
+    uint64_t count() const { return m_head->load(std::memory_order_acquire); }
+    /**
+     * Push a sample
+     * @param[in] time of sample
+     * @param[in] value of sample
+     * @note only a single thread may push
+     */
+    void push(uint64_t time, int64_t value);
+    /**
+     * Copy recent samples
+     * @param[out] times of samples, oldest first
+     * @param[out] values of samples, oldest first
+     * @param[in] count maximum number of samples
+     * @return number of samples copied
+     * @note may be called from any thread
+     */
+    size_t read(uint64_t *times, int64_t *values, size_t count) const;
+};
+
+/**
+ * @brief Store of telemetry time series
+ * @details
+ *  Keep a time series for each port and metric, fed from parsed
+ *  TIME_STATUS_NP, CURRENT_DATA_SET and PORT_STATS_NP replies.
+ *  Series are created on their first sample and are never removed,
+ *  readers on other threads may use the series without locks.
+ * @note feed from a single thread.
+ */
+class SeriesStore
+{
+  private:
+    /* Clock, port and metric */
+    typedef std::pair<uint64_t, uint32_t> Key;
+    size_t m_capacity;
+    size_t m_maxSeries;
+    std::unique_ptr<TimeSeries *[]> m_series;
+    std::atomic<size_t> m_size;
+    std::map<Key, TimeSeries *> m_index; /* Used by writer only */
+    bool m_enabled[SERIES_METRICS];
+    size_t sample(const PortIdentity_t &port, SeriesMetric_e metric,
+        uint64_t time, int64_t value);
+
+  public:
+    /**
+     * Constructor
+     * @param[in] maxSeries maximum number of series
+     * @param[in] capacity number of slots in each series,
+     *  see TimeSeries::TimeSeries()
+     */
+    SeriesStore(size_t maxSeries = 16384, size_t capacity = 1024);
+    ~SeriesStore();
+    /**
+     * Enable or disable a metric
+     * @param[in] metric to change
+     * @param[in] enable true to keep samples of the metric
+     * @return true if metric is valid
+     * @note all metrics are enabled by default
+     */
+    bool setMetric(SeriesMetric_e metric, bool enable);
+    /**
+     * Feed samples from a parsed message
+     * @param[in] msg parsed reply or notification
+     * @param[in] time of the samples
+     * @return number of samples added
+     */
+    size_t feed(const Message &msg, uint64_t time);
+    /**
+     * Feed samples from management TLV data
+     * @param[in] peer port that sent the data
+     * @param[in] id management ID
+     * @param[in] data management TLV data
+     * @param[in] time of the samples
+     * @return number of samples added
+     */
+    size_t feed(const PortIdentity_t &peer, mng_vals_e id,
+        const BaseMngTlv *data, uint64_t time);
+    /**
+     * Get number of series
+     * @return number of series
+     * @note may be called from any thread
+     */
+    size_t size() const { return m_size.load(std::memory_order_acquire); }
+    /**
+     * Get a series
+     * @param[in] index of series, less than size()
+     * @return series or null
+     * @note may be called from any thread
+     */
+    const TimeSeries *get(size_t index) const;
+    /**
+     * Find a series
+     * @param[in] port of the clock, port number 0 for clock metrics
+     * @param[in] metric of the series
+     * @return series or null
+     * @note may be called from any thread, searches all series
+     */
+    const TimeSeries *find(const PortIdentity_t &port,
+        SeriesMetric_e metric) const;
+};
+
+#endif /*__PMC_SERIES_H*/
@@ -9,12 +9,26 @@
  */
 
 #include <pwd.h>
+#include <poll.h>
+#include <sched.h>
+#include <cerrno>
+#include <mutex>
+#include <atomic>
+#include <cstring>
+#include <algorithm>
 #include <unistd.h>
 #include <sys/time.h>
+#include <sys/syscall.h>
 #include <arpa/inet.h>
+#include <netinet/udp.h>
 #include <linux/filter.h>
+#include <linux/net_tstamp.h>
+#include <linux/errqueue.h>
+#include <linux/sock_diag.h>
 #include "end.h"
+#include "msg.h"
 #include "sock.h"
+#include "timer.h"
 
 const uint16_t udp_port = 320;
 const char *ipv4_udp_mc = "224.0.1.129";
@@ -23,6 +37,14 @@ const char *ipv6_udp_mc = "ff0e::181";
 const char *useDefstr = "/.pmc.";
 const char *rootBasestr = "/var/run/pmc.";
 const size_t unix_path_max = sizeof(((sockaddr_un *)nullptr)->sun_path) - 1;
+const int64_t nsec_per_sec = 1000000000;
+/* Missing hardware transmit time stamps before using software */
+const uint32_t tx_ts_max_miss = 8;
+// PTP header
+const size_t ptp_flags_offset = 6; // flagField first octet
+const uint8_t ptp_unicast_flag = 1 << 2;
+const size_t ptp_src_port_offset = 20; // sourcePortIdentity
+const size_t max_shards = 64;
 
 // Berkeley Packet Filter code
 // The code run on network order (big endian).
@@ -32,29 +54,135 @@ const uint16_t OP_LDB = BPF_LD  | BPF_B   | BPF_ABS;
 const uint16_t OP_LDH = BPF_LD  | BPF_H   | BPF_ABS;
 // 0x20 Load word (4 bytes)
 const uint16_t OP_LDW = BPF_LD  | BPF_W   | BPF_ABS;
+// 0x80 Load packet length
+const uint16_t OP_LDLEN = BPF_LD | BPF_W  | BPF_LEN;
+//  0x0 Load immediate
+const uint16_t OP_LDI = BPF_LD  | BPF_IMM;
+// 0x54 And immediate
+const uint16_t OP_AND = BPF_ALU | BPF_AND | BPF_K;
+// 0x7c Right shift by index register
+const uint16_t OP_RSHX = BPF_ALU | BPF_RSH | BPF_X;
+// 0x07 Copy to index register
+const uint16_t OP_TAX = BPF_MISC | BPF_TAX;
+// 0xac Xor with index register
+const uint16_t OP_XORX = BPF_ALU | BPF_XOR | BPF_X;
+// 0x24 Multiply immediate
+const uint16_t OP_MUL = BPF_ALU | BPF_MUL | BPF_K;
+// 0x74 Right shift immediate
+const uint16_t OP_RSH = BPF_ALU | BPF_RSH | BPF_K;
+// 0x94 Modulo immediate
+const uint16_t OP_MOD = BPF_ALU | BPF_MOD | BPF_K;
+//  0x5 Jump always
+const uint16_t OP_JA  = BPF_JMP | BPF_JA;
 // 0x15 Jump Equal
 const uint16_t OP_JEQ = BPF_JMP | BPF_JEQ | BPF_K;
+// 0x25 Jump Greater
+const uint16_t OP_JGT = BPF_JMP | BPF_JGT | BPF_K;
+// 0x35 Jump Greater or Equal
+const uint16_t OP_JGE = BPF_JMP | BPF_JGE | BPF_K;
 //  0x6 Return with pass or drop
 const uint16_t OP_RET = BPF_RET | BPF_K;
+// 0x16 Return accumulator
+const uint16_t OP_RETA = BPF_RET | BPF_A;
+const uint32_t BPF_PASS = 0x40000;
+// Jump place holder, replaced with jump to drop
+const uint8_t J_DROP = 0xff;
+// PTP header offsets used by filter
+const uint32_t ptp_domain_offset = 4;
+const uint32_t ptp_minor_sdo_offset = 5;
+const uint32_t ptp_seq_offset = 30;
+const uint32_t ptp_target_offset = 34;
+const uint32_t ptp_hdr_len = 34;
+const uint32_t ptp_target_hdr_len = 44;
 
 /*
- * Filter to receive PTP frames with ethernet protocol 1558
+ * Build filter of PTP messages
+ * Without criteria the filter receive PTP frames with ethernet protocol 1558
  * From: sudo tcpdump -d  ether proto 0x88F7
  *       sudo tcpdump -dd ether proto 0x88F7
  * See: 'man 7 pcap-filter' for filter syntax
  */
-const sock_filter bpf_code[] = {
+static void buildFilter(std::vector<sock_filter> &code, const PtpFilter *flt,
+    uint32_t off, bool ether)
+{
     // opcode  Jump true  Jump false  field (32 bits)
-    { OP_LDH,  0,         0,          12 },
-    { OP_JEQ,  0,         1,          ETH_P_1588 },
-    { OP_RET,  0,         0,          0x40000 }, // pass
-    { OP_RET,  0,         0,          0 },       // toss
-};
-const sock_fprog bpf = {
-    // Number of code lines
-    .len = sizeof(bpf_code) / sizeof(sock_filter),
-    .filter = (sock_filter *)bpf_code,
-};
+    code.clear();
+    if(ether) {
+        code.push_back({ OP_LDH, 0, 0, 12 });
+        code.push_back({ OP_JEQ, 0, J_DROP, ETH_P_1588 });
+    }
+    if(flt != nullptr) {
+        code.push_back({ OP_LDLEN, 0, 0, 0 });
+        code.push_back({ OP_JGE, 0, J_DROP, off +
+                (flt->useTarget ? ptp_target_hdr_len : ptp_hdr_len)
+            });
+        if(flt->msgTypes != 0) {
+            // Test message type bit in mask
+            code.push_back({ OP_LDB, 0, 0, off });
+            code.push_back({ OP_AND, 0, 0, 0xf });
+            code.push_back({ OP_TAX, 0, 0, 0 });
+            code.push_back({ OP_LDI, 0, 0, flt->msgTypes });
+            code.push_back({ OP_RSHX, 0, 0, 0 });
+            code.push_back({ OP_AND, 0, 0, 1 });
+            code.push_back({ OP_JEQ, J_DROP, 0, 0 });
+        }
+        if(flt->sdoId >= 0) {
+            code.push_back({ OP_LDB, 0, 0, off });
+            code.push_back({ OP_AND, 0, 0, 0xf0 });
+            code.push_back({ OP_JEQ, 0, J_DROP,
+                    (uint32_t)(flt->sdoId >> 4) & 0xf0 });
+            code.push_back({ OP_LDB, 0, 0, off + ptp_minor_sdo_offset });
+            code.push_back({ OP_JEQ, 0, J_DROP, (uint32_t)flt->sdoId & 0xff });
+        }
+        if(flt->domainNumber >= 0) {
+            code.push_back({ OP_LDB, 0, 0, off + ptp_domain_offset });
+            code.push_back({ OP_JEQ, 0, J_DROP,
+                    (uint32_t)flt->domainNumber & 0xff });
+        }
+        if(flt->useSequence) {
+            code.push_back({ OP_LDH, 0, 0, off + ptp_seq_offset });
+            if(flt->seqFirst <= flt->seqLast)
+                code.push_back({ OP_JGE, 0, J_DROP, flt->seqFirst });
+            else // Wrap around
+                code.push_back({ OP_JGE, 1, 0, flt->seqFirst });
+            code.push_back({ OP_JGT, J_DROP, 0, flt->seqLast });
+        }
+        if(flt->useTarget) {
+            const uint8_t *t = flt->targetClock;
+            uint32_t w0 = t[0] << 24 | t[1] << 16 | t[2] << 8 | t[3];
+            uint32_t w1 = t[4] << 24 | t[5] << 16 | t[6] << 8 | t[7];
+            uint32_t to = off + ptp_target_offset;
+            // Only Management and Signaling have a target
+            code.push_back({ OP_LDB, 0, 0, off });
+            code.push_back({ OP_AND, 0, 0, 0xf });
+            code.push_back({ OP_JEQ, 1, 0, Signaling });
+            code.push_back({ OP_JEQ, 0, 9, Management });
+            // Target clock identity
+            code.push_back({ OP_LDW, 0, 0, to });
+            code.push_back({ OP_JEQ, 0, 3, w0 });
+            code.push_back({ OP_LDW, 0, 0, to + 4 });
+            code.push_back({ OP_JEQ, 0, 1, w1 });
+            code.push_back({ OP_JA, 0, 0, 4 });
+            // All clocks
+            code.push_back({ OP_LDW, 0, 0, to });
+            code.push_back({ OP_JEQ, 0, J_DROP, UINT32_MAX });
+            code.push_back({ OP_LDW, 0, 0, to + 4 });
+            code.push_back({ OP_JEQ, 0, J_DROP, UINT32_MAX });
+        }
+    }
+    code.push_back({ OP_RET, 0, 0, BPF_PASS });
+    size_t drop = code.size();
+    code.push_back({ OP_RET, 0, 0, 0 });
+    for(size_t i = 0; i < drop; i++) {
+        sock_filter &c = code[i];
+        if(BPF_CLASS(c.code) != BPF_JMP || c.code == OP_JA)
+            continue;
+        if(c.jt == J_DROP)
+            c.jt = drop - i - 1;
+        if(c.jf == J_DROP)
+            c.jf = drop - i - 1;
+    }
+}
 
 void SockBase::closeBase()
 {
@@ -62,21 +190,494 @@ void SockBase::closeBase()
         ::close(m_fd);
         m_fd = -1;
     }
+    m_queue.clear();
 }
 bool SockBase::sendReply(ssize_t cnt, size_t len) const
 {
     if(cnt < 0) {
-        perror("send");
-        return false;
+        if((m_sendFlags & MSG_DONTWAIT) && (errno == EAGAIN ||
+                errno == EWOULDBLOCK || errno == ENOBUFS))
+            return sendFull();
+        m_stats.txErrors++;
+        return sysErr("send");
     }
     if(cnt != (ssize_t)len) {
-        fprintf(stderr, "send %zd instead of %zu\n", cnt, len);
+        m_stats.txErrors++;
+        return setErr(SOCK_ERR_SEND_SHORT, "send", cnt, len);
+    }
+    m_stats.txPackets++;
+    return true;
+}
+bool SockBase::sendFull() const
+{
+    if(m_sendFlags & MSG_DONTWAIT) {
+        // The message is queued, not an error
+        m_err = {SOCK_ERR_SEND_FULL, 0, "send", 0, 0};
+        return false;
+    }
+    m_stats.txErrors++;
+    return setErr(SOCK_ERR_SEND_FULL, "send");
+}
+bool SockBase::sendRate()
+{
+    m_stats.txThrottled++;
+    return setErr(SOCK_ERR_SEND_RATE, "send");
+}
+bool SockBase::setRateLimit(uint64_t rate, uint64_t burst)
+{
+    if(!m_rate.set(rate, burst))
+        return false;
+    m_rateReserved = 0;
+    return true;
+}
+uint64_t SockBase::getRateWait()
+{
+    return m_rate.wait(nowUs());
+}
+bool SockBase::reserveRate()
+{
+    if(!m_rate.isLimited())
+        return true;
+    if(m_rate.take(nowUs()) == 0)
+        return false;
+    m_rateReserved++;
+    return true;
+}
+bool SockBase::rateAllow(uint64_t now)
+{
+    return m_rateReserved > 0 || m_rate.wait(now) == 0;
+}
+void SockBase::rateTake(uint64_t now)
+{
+    if(m_rateReserved > 0)
+        m_rateReserved--;
+    else
+        m_rate.take(now);
+}
+bool SockBase::sendNoWait(const void *msg, size_t len)
+{
+    m_err.reason = SOCK_ERR_NONE;
+    m_sendFlags = MSG_DONTWAIT;
+    bool ret = sendBase(msg, len);
+    m_sendFlags = 0;
+    return ret;
+}
+bool SockBase::setSendQueue(SockQueue_e policy, size_t maxDepth)
+{
+    switch(policy) {
+        case SOCK_QUEUE_NONE:
+            m_queue.clear();
+            break;
+        case SOCK_QUEUE_DROP_OLDEST:
+        case SOCK_QUEUE_BLOCK:
+            if(maxDepth == 0)
+                return false;
+            for(; m_queue.size() > maxDepth; m_stats.txQueueDrops++)
+                m_queue.pop_front();
+            break;
+        default:
+            return false;
+    }
+    m_queuePolicy = policy;
+    m_queueMax = maxDepth;
+    return true;
+}
+bool SockBase::flush()
+{
+    if(!m_isInit)
+        return m_queue.empty();
+    uint64_t now = nowUs();
+    while(!m_queue.empty()) {
+        // Keep messages till the rate limit allows
+        if(!rateAllow(now))
+            return false;
+        const std::vector<uint8_t> &msg = m_queue.front();
+        if(sendNoWait(msg.data(), msg.size()))
+            rateTake(now);
+        // Drop a message that fails for another reason
+        else if(m_err.reason == SOCK_ERR_SEND_FULL)
+            return false;
+        m_queue.pop_front();
+    }
+    return true;
+}
+bool SockBase::sendQueue(const void *msg, size_t len)
+{
+    uint64_t now = nowUs();
+    if(m_queuePolicy == SOCK_QUEUE_NONE) {
+        if(!rateAllow(now))
+            return sendRate();
+        if(!sendBase(msg, len))
+            return false;
+        rateTake(now);
+        return true;
+    }
+    // Send queued messages first to keep the order
+    if(flush()) {
+        if(!rateAllow(now))
+            m_stats.txThrottled++;
+        else if(sendNoWait(msg, len)) {
+            rateTake(now);
+            return true;
+        } else if(m_err.reason != SOCK_ERR_SEND_FULL)
+            return false;
+    } else if(!rateAllow(now))
+        m_stats.txThrottled++;
+    while(m_queue.size() >= m_queueMax) {
+        if(m_queuePolicy == SOCK_QUEUE_DROP_OLDEST) {
+            m_queue.pop_front();
+            m_stats.txQueueDrops++;
+            continue;
+        }
+        now = nowUs();
+        if(!rateAllow(now))
+            usleep(m_rate.wait(now)); // Wait for the rate limit
+        else if(m_fd >= 0) {
+            pollfd pfd = { m_fd, POLLOUT, 0 };
+            if(::poll(&pfd, 1, -1) < 0 && errno != EINTR) {
+                m_stats.txErrors++;
+                return sysErr("poll");
+            }
+        } else
+            sched_yield(); // In memory socket
+        flush();
+    }
+    const uint8_t *ptr = (const uint8_t *)msg;
+    m_queue.emplace_back(ptr, ptr + len);
+    m_stats.txQueued++;
+    return true;
+}
+size_t SockBase::sendBatchBase(const void *const *msgs, const size_t *lens,
+    size_t count)
+{
+    size_t sent = 0;
+    while(sent < count && sendQueue(msgs[sent], lens[sent]))
+        sent++;
+    return sent;
+}
+size_t SockBase::sendMmsg(const void *const *msgs, const size_t *lens,
+    size_t count, const void *name, socklen_t nameLen, const void *hdr,
+    size_t hdrLen)
+{
+    const size_t vlen = 64; // Messages per system call
+    mmsghdr mm[vlen];
+    iovec iov[vlen][2];
+    size_t sent = 0;
+    // Reserved tokens first
+    size_t allowed = std::min(count, m_rateReserved);
+    m_rateReserved -= allowed;
+    allowed += m_rate.take(nowUs(), count - allowed);
+    if(allowed < count) {
+        m_stats.txThrottled += count - allowed;
+        setErr(SOCK_ERR_SEND_RATE, "send");
+        count = allowed;
+    }
+    while(sent < count) {
+        size_t num = std::min(count - sent, vlen);
+        memset(mm, 0, sizeof(mmsghdr) * num);
+        for(size_t i = 0; i < num; i++) {
+            size_t cnt = 0;
+            if(hdr != nullptr)
+                iov[i][cnt++] = { (void *)hdr, hdrLen };
+            iov[i][cnt++] = { (void *)msgs[sent + i], lens[sent + i] };
+            msghdr &mh = mm[i].msg_hdr;
+            mh.msg_name = (void *)name;
+            mh.msg_namelen = nameLen;
+            mh.msg_iov = iov[i];
+            mh.msg_iovlen = cnt;
+        }
+        int ret = sendmmsg(m_fd, mm, num, 0);
+        if(ret <= 0) {
+            m_stats.txErrors++;
+            sysErr("sendmmsg");
+            return sent;
+        }
+        // A short message is still sent, keep its error and continue
+        for(int i = 0; i < ret; i++)
+            sendReply(mm[i].msg_len, hdrLen + lens[sent + i]);
+        sent += ret;
+    }
+    return sent;
+}
+ssize_t SockBase::rcvReply(ssize_t cnt, size_t bufSize, bool block,
+    size_t hdrLen) const
+{
+    if(cnt < 0) {
+        if(block || errno != EAGAIN) {
+            m_stats.rxErrors++;
+            sysErr("recv");
+        }
+        return -1;
+    }
+    if(cnt > (ssize_t)bufSize) {
+        m_stats.rxOversized++;
+        setErr(SOCK_ERR_RCV_SIZE, "rcv", cnt, bufSize);
+        return -1;
+    }
+    m_stats.rxPackets++;
+    if(cnt < (ssize_t)(hdrLen + ptp_hdr_len))
+        m_stats.rxShort++;
+    return cnt;
+}
+void SockBase::statsBase()
+{
+    uint32_t info[SK_MEMINFO_VARS];
+    socklen_t len = sizeof(info);
+    if(m_isInit && getsockopt(m_fd, SOL_SOCKET, SO_MEMINFO, info, &len) == 0 &&
+        len > SK_MEMINFO_DROPS * sizeof(uint32_t))
+        m_stats.rxDrops = info[SK_MEMINFO_DROPS];
+}
+bool SockBase::initRcv()
+{
+    if(m_fd < 0) // No kernel socket
+        return true;
+    int on = 1;
+    if(setsockopt(m_fd, SOL_SOCKET, SO_RXQ_OVFL, &on, sizeof(on)) != 0)
+        return sysErr("SO_RXQ_OVFL");
+    if(m_rcvBufSize <= 0)
+        return true;
+    // Try to exceed the system maximum first
+    if(setsockopt(m_fd, SOL_SOCKET, SO_RCVBUFFORCE, &m_rcvBufSize,
+            sizeof(m_rcvBufSize)) == 0)
+        return true;
+    if(setsockopt(m_fd, SOL_SOCKET, SO_RCVBUF, &m_rcvBufSize,
+            sizeof(m_rcvBufSize)) != 0)
+        return sysErr("SO_RCVBUF");
+    return true;
+}
+bool SockBase::setRcvBufSize(int size)
+{
+    if(size <= 0)
         return false;
+    m_rcvBufSize = size;
+    return !m_isInit || initRcv();
+}
+int SockBase::getRcvBufSize() const
+{
+    int size;
+    socklen_t len = sizeof(size);
+    if(!m_isInit ||
+        getsockopt(m_fd, SOL_SOCKET, SO_RCVBUF, &size, &len) != 0)
+        return -1;
+    return size;
+}
+int64_t SockBase::rtt(const SockTimeStamp &tx, const SockTimeStamp &rx)
+{
+    // Software and hardware use different clocks
+    if(tx.hw != 0 && rx.hw != 0)
+        return rx.hw - tx.hw;
+    if(tx.sw != 0 && rx.sw != 0)
+        return rx.sw - tx.sw;
+    return -1;
+}
+static inline int64_t toNsec(const timespec &ts)
+{
+    return (int64_t)ts.tv_sec * nsec_per_sec + ts.tv_nsec;
+}
+/* Error queue message of IP and packet sockets */
+static inline bool isErrCtrl(const cmsghdr *cm)
+{
+    return (cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) ||
+        (cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR) ||
+        (cm->cmsg_level == SOL_PACKET &&
+            cm->cmsg_type == PACKET_TX_TIMESTAMP);
+}
+static void parseCtrl(msghdr &msg, SockTimeStamp *ts, uint64_t *drops,
+    uint32_t *key = nullptr)
+{
+    for(cmsghdr *cm = CMSG_FIRSTHDR(&msg); cm != nullptr;
+        cm = CMSG_NXTHDR(&msg, cm)) {
+        if(cm->cmsg_level != SOL_SOCKET) {
+            // Key of the sent frame the time stamp belongs to
+            if(key != nullptr && isErrCtrl(cm)) {
+                sock_extended_err err;
+                memcpy(&err, CMSG_DATA(cm), sizeof(err));
+                if(err.ee_origin == SO_EE_ORIGIN_TIMESTAMPING)
+                    *key = err.ee_data;
+            }
+            continue;
+        }
+        if(ts != nullptr && cm->cmsg_type == SCM_TIMESTAMPING) {
+            scm_timestamping tss;
+            memcpy(&tss, CMSG_DATA(cm), sizeof(tss));
+            ts->sw = toNsec(tss.ts[0]);
+            ts->hw = toNsec(tss.ts[2]);
+        } else if(drops != nullptr && cm->cmsg_type == SO_RXQ_OVFL) {
+            uint32_t cnt;
+            memcpy(&cnt, CMSG_DATA(cm), sizeof(cnt));
+            *drops = cnt;
+        }
+    }
+}
+static void defLogger(const SockError &err, uint32_t suppressed, void *)
+{
+    if(suppressed > 0)
+        fprintf(stderr, "%u socket errors suppressed\n", suppressed);
+    switch(err.reason) {
+        case SOCK_ERR_SYS:
+            fprintf(stderr, "%s: %s\n", err.op, strerror(err.err));
+            break;
+        case SOCK_ERR_SEND_SHORT:
+            fprintf(stderr, "%s %zd instead of %zu\n", err.op, err.cnt, err.len);
+            break;
+        case SOCK_ERR_SEND_SIZE:
+            fprintf(stderr, "%s %zd more than frame size %zu\n", err.op,
+                err.cnt, err.len);
+            break;
+        case SOCK_ERR_RCV_SIZE:
+            fprintf(stderr, "%s %zd more than buffer size %zu\n", err.op,
+                err.cnt, err.len);
+            break;
+        default:
+            fprintf(stderr, "%s: %s\n", err.op, SockBase::errStr(err.reason));
+            break;
     }
+}
+static std::mutex logLock; // Protect the logger
+static SockLogFunc logFunc = defLogger;
+static void *logCookie = nullptr;
+static std::atomic<uint32_t> logRate(10); // Errors per second
+/* Current second in upper 32 bits, errors logged in it in lower bits */
+static std::atomic<uint64_t> logSlot(0);
+static std::atomic<uint32_t> logSuppressed(0);
+const char *SockBase::errStr(SockErr_e reason)
+{
+    switch(reason) {
+        case SOCK_ERR_NONE:
+            return "no error";
+        case SOCK_ERR_NOT_INIT:
+            return "socket is not initialized";
+        case SOCK_ERR_SYS:
+            return "system call failed";
+        case SOCK_ERR_PARAM:
+            return "wrong parameter";
+        case SOCK_ERR_SEND_SHORT:
+            return "message was sent partially";
+        case SOCK_ERR_SEND_FULL:
+            return "transmit queue is full";
+        case SOCK_ERR_SEND_SIZE:
+            return "message is bigger than frame";
+        case SOCK_ERR_RCV_SIZE:
+            return "message is bigger than buffer";
+        case SOCK_ERR_RCV_PEER:
+            return "message from another address";
+        case SOCK_ERR_NO_PEER:
+            return "unknown peer address";
+        case SOCK_ERR_SEND_RATE:
+            return "send rate limit exceeded";
+        case SOCK_ERR_PEER_CLOSED:
+            return "peer socket is closed";
+    }
+    return "unknown";
+}
+void SockBase::setLogger(SockLogFunc func, void *cookie)
+{
+    std::lock_guard<std::mutex> lock(logLock);
+    logFunc = func;
+    logCookie = cookie;
+}
+void SockBase::setLogRate(uint32_t maxPerSec)
+{
+    logRate.store(maxPerSec, std::memory_order_relaxed);
+}
+void SockBase::logError(const SockError &err)
+{
+    // Drop errors above the rate without the lock
+    uint32_t rate = logRate.load(std::memory_order_relaxed);
+    if(rate > 0) {
+        uint64_t sec = (nowUs() / 1000000) << 32;
+        uint64_t slot = logSlot.load(std::memory_order_relaxed);
+        uint64_t next;
+        do {
+            if((slot & ~(uint64_t)UINT32_MAX) != sec)
+                next = sec | 1;
+            else if((slot & UINT32_MAX) >= rate) {
+                logSuppressed.fetch_add(1, std::memory_order_relaxed);
+                return;
+            } else
+                next = slot + 1;
+        } while(!logSlot.compare_exchange_weak(slot, next,
+                std::memory_order_relaxed));
+    }
+    std::lock_guard<std::mutex> lock(logLock);
+    uint32_t suppressed = logSuppressed.exchange(0, std::memory_order_relaxed);
+    if(logFunc != nullptr)
+        logFunc(err, suppressed, logCookie);
+}
+bool SockBase::sysErr(const char *op) const
+{
+    m_err = {SOCK_ERR_SYS, errno, op, 0, 0};
+    logError(m_err);
+    return false;
+}
+bool SockBase::setErr(SockErr_e reason, const char *op, ssize_t cnt,
+    size_t len) const
+{
+    m_err = {reason, 0, op, cnt, len};
+    logError(m_err);
+    return false;
+}
+bool SockBase::setBusyPoll(const SockBusyPoll &policy)
+{
+    if(policy.cpu >= CPU_SETSIZE)
+        return false;
+    m_busy = policy;
+    m_pinTid = 0;
+    return !m_isInit || initBusyPoll();
+}
+bool SockBase::initBusyPoll()
+{
+    if(!m_busy.enable || m_fd < 0)
+        return true;
+    if(m_busy.busyPollUs > 0 && setsockopt(m_fd, SOL_SOCKET, SO_BUSY_POLL,
+            &m_busy.busyPollUs, sizeof(m_busy.busyPollUs)) != 0)
+        return sysErr("SO_BUSY_POLL");
+    int on = 1;
+    if(m_busy.preferBusyPoll && setsockopt(m_fd, SOL_SOCKET,
+            SO_PREFER_BUSY_POLL, &on, sizeof(on)) != 0)
+        return sysErr("SO_PREFER_BUSY_POLL");
     return true;
 }
-bool SockBase::poll(uint64_t timeout_ms) const
+ssize_t SockBase::rcvPolicy(void *buf, size_t bufSize, bool block)
 {
+    if(!block || !m_busy.enable)
+        return rcvBase(buf, bufSize, block);
+    if(m_busy.cpu >= 0) {
+        long tid = syscall(SYS_gettid);
+        if(tid != m_pinTid) {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(m_busy.cpu, &set);
+            if(sched_setaffinity(0, sizeof(set), &set) != 0)
+                sysErr("sched_setaffinity");
+            m_pinTid = tid;
+        }
+    }
+    uint64_t end = nowUs() + m_busy.spinUs;
+    do {
+        errno = 0;
+        ssize_t cnt = rcvBase(buf, bufSize, false);
+        if(cnt >= 0 || errno != EAGAIN)
+            return cnt;
+    } while(nowUs() < end);
+    return rcvBase(buf, bufSize, true);
+}
+bool SockBase::pollBase(uint64_t timeout_ms) const
+{
+    if(m_busy.enable && m_busy.spinUs > 0) {
+        uint64_t start = nowUs();
+        uint64_t now = start;
+        pollfd pfd = { m_fd, POLLIN, 0 };
+        do {
+            if(::poll(&pfd, 1, 0) > 0)
+                return true;
+            now = nowUs();
+        } while(now - start < m_busy.spinUs);
+        if(timeout_ms > 0) {
+            uint64_t pass = (now - start) / 1000;
+            timeout_ms = timeout_ms > pass ? timeout_ms - pass : 1;
+        }
+    }
     timeval to, *pto;
     if(timeout_ms > 0) {
         to = {
@@ -115,7 +716,7 @@ bool SockBase::tpoll(uint64_t &timeout_ms) const
 static inline bool testUnix(const std::string &str)
 {
     size_t len = str.length();
-    if(len < 2 || len > unix_path_max || str.substr(0, 1) != "/")
+    if(len < 2 || len > unix_path_max || str[0] != '/')
         return false;
     return true;
 }
@@ -139,16 +740,12 @@ bool SockUnix::initBase()
         return false;
     SockBase::closeBase();
     m_fd = socket(AF_UNIX, SOCK_DGRAM, 0);
-    if(m_fd < 0) {
-        perror("socket");
-        return false;
-    }
+    if(m_fd < 0)
+        return sysErr("socket");
     sockaddr_un addr;
     setUnixAddr(addr, m_me);
-    if(bind(m_fd, (sockaddr *)&addr, sizeof(addr)) != 0) {
-        perror("bind");
-        return false;
-    }
+    if(bind(m_fd, (sockaddr *)&addr, sizeof(addr)) != 0)
+        return sysErr("bind");
     m_isInit = true;
     return true;
 }
@@ -203,7 +800,8 @@ const char *SockUnix::getHomeDir_c()
 bool SockUnix::sendAny(const void *msg, size_t len,
     const sockaddr_un &addr) const
 {
-    ssize_t cnt = sendto(m_fd, msg, len, 0, (sockaddr *)&addr, sizeof(addr));
+    ssize_t cnt = sendto(m_fd, msg, len, m_sendFlags, (sockaddr *)&addr,
+            sizeof(addr));
     return sendReply(cnt, len);
 }
 bool SockUnix::sendBase(const void *msg, size_t len)
@@ -212,6 +810,15 @@ bool SockUnix::sendBase(const void *msg, size_t len)
         return false;
     return sendAny(msg, len, m_peerAddr);
 }
+size_t SockUnix::sendBatchBase(const void *const *msgs, const size_t *lens,
+    size_t count)
+{
+    if(!m_isInit || !testUnix(m_peer))
+        return 0;
+    if(m_queuePolicy != SOCK_QUEUE_NONE)
+        return SockBase::sendBatchBase(msgs, lens, count);
+    return sendMmsg(msgs, lens, count, &m_peerAddr, sizeof(m_peerAddr));
+}
 bool SockUnix::sendTo(const void *msg, size_t len, std::string addrStr) const
 {
     if(!m_isInit || !testUnix(addrStr))
@@ -226,35 +833,69 @@ bool SockUnix::sendTo(Buf &buf, size_t len, std::string addrStr) const
 }
 ssize_t SockUnix::rcvBase(void *buf, size_t bufSize, bool block)
 {
-    if(!testUnix(m_peer))
+    if(!testUnix(m_peer)) {
+        m_err = {SOCK_ERR_NO_PEER, 0, "rcv", 0, 0};
         return -1;
-    std::string from;
-    ssize_t cnt = rcvFrom(buf, bufSize, from, block);
-    if(cnt > 0 && from == m_peer)
-        return cnt;
+    }
+    sockaddr_un addr;
+    socklen_t addrLen;
+    ssize_t cnt = rcvAny(buf, bufSize, addr, addrLen, block);
+    if(cnt < 0)
+        return -1;
+    // Unbound sender has no address
+    if(addrLen > offsetof(sockaddr_un, sun_path)) {
+        // Compare with peer address, without the null termination
+        size_t pathLen = addrLen - offsetof(sockaddr_un, sun_path);
+        pathLen = strnlen(addr.sun_path, std::min(pathLen, unix_path_max));
+        if(pathLen == m_peer.length() &&
+            memcmp(addr.sun_path, m_peerAddr.sun_path, pathLen) == 0)
+            return cnt;
+    }
+    // Discard silently
+    m_err = {SOCK_ERR_RCV_PEER, 0, "rcv", cnt, bufSize};
     return -1;
 }
-ssize_t SockUnix::rcvFrom(void *buf, size_t bufSize, std::string &from,
-    bool block) const
+ssize_t SockUnix::rcvAny(void *buf, size_t bufSize, sockaddr_un &addr,
+    socklen_t &addrLen, bool block) const
 {
-    if(!m_isInit)
+    if(!m_isInit) {
+        m_err = {SOCK_ERR_NOT_INIT, 0, "rcv", 0, 0};
         return -1;
-    sockaddr_un addr;
-    socklen_t len = sizeof(addr);
-    int flags = 0;
+    }
+    alignas(cmsghdr) uint8_t ctrl[CMSG_SPACE(sizeof(uint32_t))];
+    int flags = MSG_TRUNC;
     if(!block)
         flags |= MSG_DONTWAIT;
-    ssize_t cnt = recvfrom(m_fd, buf, bufSize, flags, (sockaddr *)&addr, &len);
-    if(cnt < 0) {
-        perror("recv");
+    iovec iov = { buf, bufSize };
+    msghdr msg = {0};
+    msg.msg_name = &addr;
+    msg.msg_namelen = sizeof(addr);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = ctrl;
+    msg.msg_controllen = sizeof(ctrl);
+    ssize_t cnt = rcvReply(recvmsg(m_fd, &msg, flags), bufSize, block);
+    if(cnt < 0)
         return -1;
-    }
-    if(cnt > (ssize_t)bufSize) {
-        fprintf(stderr, "rcv %zd more than buffer size %zu\n", cnt, bufSize);
+    parseCtrl(msg, nullptr, &m_stats.rxDrops);
+    addrLen = msg.msg_namelen;
+    return cnt;
+}
+ssize_t SockUnix::rcvFrom(void *buf, size_t bufSize, std::string &from,
+    bool block) const
+{
+    sockaddr_un addr;
+    socklen_t addrLen;
+    ssize_t cnt = rcvAny(buf, bufSize, addr, addrLen, block);
+    if(cnt < 0)
         return -1;
+    // Unbound sender has no address
+    if(addrLen <= offsetof(sockaddr_un, sun_path))
+        from.clear();
+    else {
+        addr.sun_path[unix_path_max] = 0; // Ensure string is null terminated
+        from = addr.sun_path;
     }
-    addr.sun_path[unix_path_max] = 0; // Ensure string is null terminated
-    from = addr.sun_path;
     return cnt;
 }
 bool SockBaseIf::setInt(IfInfo &ifObj)
@@ -262,9 +903,121 @@ bool SockBaseIf::setInt(IfInfo &ifObj)
     m_ifName = ifObj.ifName();
     m_ifIndex = ifObj.ifIndex();
     m_mac = ifObj.mac();
+    m_ptpIndex = ifObj.ptpIndex();
     m_have_if = true;
     return true;
 }
+bool SockBaseIf::setTimeStamping(bool enable)
+{
+    if(m_isInit)
+        return false;
+    m_useTs = enable;
+    return true;
+}
+static bool setTsFlags(int fd, bool rxHw, bool txHw)
+{
+    // Transmit time stamps carry the key of their frame
+    int flags = SOF_TIMESTAMPING_SOFTWARE | SOF_TIMESTAMPING_RX_SOFTWARE |
+        SOF_TIMESTAMPING_OPT_TSONLY | SOF_TIMESTAMPING_OPT_ID;
+    if(rxHw || txHw)
+        flags |= SOF_TIMESTAMPING_RAW_HARDWARE;
+    if(rxHw)
+        flags |= SOF_TIMESTAMPING_RX_HARDWARE;
+    if(txHw)
+        flags |= SOF_TIMESTAMPING_TX_HARDWARE;
+    else
+        flags |= SOF_TIMESTAMPING_TX_SOFTWARE;
+    return setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPING, &flags,
+            sizeof(flags)) == 0;
+}
+bool SockBaseIf::setFilter(const PtpFilter &filter)
+{
+    m_filter = filter;
+    m_useFilter = true;
+    return !m_isInit || applyFilter();
+}
+bool SockBaseIf::clearFilter()
+{
+    m_useFilter = false;
+    return !m_isInit || applyFilter();
+}
+bool SockBaseIf::attachFilter(int fd, size_t offset, bool ether)
+{
+    std::vector<sock_filter> code;
+    buildFilter(code, m_useFilter ? &m_filter : nullptr, offset, ether);
+    sock_fprog bpf = {
+        .len = (unsigned short)code.size(),
+        .filter = code.data(),
+    };
+    if(setsockopt(fd, SOL_SOCKET, SO_ATTACH_FILTER, &bpf, sizeof(bpf)) != 0)
+        return sysErr("SO_ATTACH_FILTER");
+    return true;
+}
+bool SockBaseIf::initTs()
+{
+    if(!m_useTs)
+        return true;
+    m_hwTxTs = m_ptpIndex >= 0;
+    m_txTsWait = false;
+    m_txTsMiss = 0;
+    m_txTsKey = 0;
+    if(!setTsFlags(m_fd, m_ptpIndex >= 0, m_hwTxTs))
+        return sysErr("SO_TIMESTAMPING");
+    return true;
+}
+void SockBaseIf::rcvCtrl(msghdr &msg)
+{
+    m_rxTs = {0};
+    parseCtrl(msg, &m_rxTs, &m_stats.rxDrops);
+    if(m_txTsWait)
+        rcvTxTs();
+}
+/*
+ * Fetch transmit time stamp of last sent frame, without waiting
+ * Time stamps of frames sent before are dropped
+ */
+void SockBaseIf::rcvTxTs()
+{
+    msghdr msg = {0};
+    msg.msg_control = m_ctrl;
+    msg.msg_controllen = sizeof(m_ctrl);
+    while(m_txTsWait && recvmsg(m_fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) >= 0) {
+        SockTimeStamp ts = {0};
+        uint32_t key = m_txTsKey; // Not a key of a sent frame
+        parseCtrl(msg, &ts, nullptr, &key);
+        if(key == m_txTsKey - 1 && (ts.sw != 0 || ts.hw != 0)) {
+            m_txTs = ts;
+            m_txTsWait = false;
+        }
+        msg.msg_controllen = sizeof(m_ctrl);
+    }
+}
+void SockBaseIf::preSendTs()
+{
+    if(m_useTs) {
+        // Time stamp of previous frame may arrive late
+        rcvTxTs();
+        if(!m_txTsWait)
+            m_txTsMiss = 0;
+        else if(m_hwTxTs && ++m_txTsMiss >= tx_ts_max_miss) {
+            // Network interface does not provide hardware transmit time stamp
+            m_hwTxTs = false;
+            if(!setTsFlags(m_fd, m_ptpIndex >= 0, false))
+                sysErr("SO_TIMESTAMPING");
+        }
+    }
+    m_txTs = {0};
+    m_txTsWait = false;
+}
+void SockBaseIf::sendTs(size_t frames)
+{
+    if(!m_useTs || frames == 0)
+        return;
+    // The kernel gives each sent frame the next key
+    m_txTsKey += frames;
+    m_txTsWait = true;
+    rcvTxTs();
+}
 bool SockBaseIf::setIfUsingName(const std::string ifName)
 {
     if(m_isInit)
@@ -292,6 +1045,7 @@ bool SockBaseIf::setIf(IfInfo &ifObj)
     return false;
 }
 SockIp::SockIp(int domain, const char *mcast, sockaddr *addr, size_t len) :
+    m_shards(1),
     m_domain(domain),
     m_udp_ttl(-1),
     m_addr(addr),
@@ -299,6 +1053,194 @@ SockIp::SockIp(int domain, const char *mcast, sockaddr *addr, size_t len) :
     m_mcast_str(mcast)
 {
 }
+void SockIp::closeBase()
+{
+    m_peers.clear();
+    for(int fd : m_shardFds)
+        ::close(fd);
+    m_shardFds.clear();
+    SockBase::closeBase();
+}
+void SockIp::learnPeer(const void *buf, size_t len, socklen_t addrLen)
+{
+    if(len < ptp_src_port_offset + PortIdentity_t::size() ||
+        addrLen > sizeof(m_from))
+        return;
+    const uint8_t *src = (const uint8_t *)buf + ptp_src_port_offset;
+    PeerKey key;
+    uint16_t port;
+    memcpy(&key.first, src, sizeof(key.first));
+    memcpy(&port, src + ClockIdentity_t::size(), sizeof(port));
+    key.second = net_to_cpu16(port);
+    PeerAddr &peer = m_peers[key];
+    memcpy(&peer.addr, &m_from, addrLen);
+    peer.len = addrLen;
+}
+bool SockIp::havePeer(const PortIdentity_t &peer) const
+{
+    PeerKey key;
+    memcpy(&key.first, peer.clockIdentity.v, sizeof(key.first));
+    key.second = peer.portNumber;
+    return m_peers.count(key) > 0;
+}
+void SockIp::removePeer(const PortIdentity_t &peer)
+{
+    PeerKey key;
+    memcpy(&key.first, peer.clockIdentity.v, sizeof(key.first));
+    key.second = peer.portNumber;
+    m_peers.erase(key);
+}
+bool SockIp::sendTo(const void *msg, size_t len, const PortIdentity_t &peer)
+{
+    if(!m_isInit || len <= ptp_flags_offset)
+        return false;
+    PeerKey key;
+    memcpy(&key.first, peer.clockIdentity.v, sizeof(key.first));
+    key.second = peer.portNumber;
+    auto it = m_peers.find(key);
+    if(it == m_peers.end())
+        return false;
+    // Unicast messages are not queued, send queued messages first
+    uint64_t now = nowUs();
+    if(!flush())
+        return rateAllow(now) ? sendFull() : sendRate();
+    if(!rateAllow(now))
+        return sendRate();
+    // Set the unicast flag without modifying the caller buffer
+    uint8_t *frame = (uint8_t *)msg;
+    uint8_t flags = frame[ptp_flags_offset] | ptp_unicast_flag;
+    iovec iov[3] = {
+        { frame, ptp_flags_offset },
+        { &flags, 1 },
+        { frame + ptp_flags_offset + 1, len - ptp_flags_offset - 1 },
+    };
+    msghdr mh = {0};
+    mh.msg_name = &it->second.addr;
+    mh.msg_namelen = it->second.len;
+    mh.msg_iov = iov;
+    mh.msg_iovlen = 3;
+    preSendTs();
+    ssize_t cnt = sendmsg(m_fd, &mh, m_sendFlags);
+    if(!sendReply(cnt, len))
+        return false;
+    rateTake(now);
+    sendTs();
+    return true;
+}
+bool SockIp::applyFilter()
+{
+    for(size_t i = 0; i < m_shards; i++) {
+        int fd = getShardFd(i);
+        if(m_useFilter) {
+            if(!attachFilter(fd, sizeof(udphdr), false))
+                return false;
+        } else {
+            int on = 1;
+            // Fails if no filter is attached
+            setsockopt(fd, SOL_SOCKET, SO_DETACH_FILTER, &on, sizeof(on));
+        }
+    }
+    return true;
+}
+bool SockIp::setShards(size_t shards)
+{
+    if(m_isInit || shards < 1 || shards > max_shards)
+        return false;
+    m_shards = shards;
+    return true;
+}
+int SockIp::getShardFd(size_t index) const
+{
+    if(index == 0)
+        return m_fd;
+    if(index < m_shards && index <= m_shardFds.size())
+        return m_shardFds[index - 1];
+    return -1;
+}
+bool SockIp::initReusePort()
+{
+    int on = 1;
+    if(setsockopt(m_fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) != 0)
+        return sysErr("SO_REUSEPORT");
+    /*
+     * Select shard using hash of source port identity
+     * The filter runs on the UDP payload
+     */
+    const sock_filter code[] = {
+        // opcode  Jump true  Jump false  field (32 bits)
+        { OP_LDW,  0,         0,          ptp_src_port_offset },
+        { OP_TAX,  0,         0,          0 },
+        { OP_LDW,  0,         0,          ptp_src_port_offset + 4 },
+        { OP_XORX, 0,         0,          0 },
+        { OP_TAX,  0,         0,          0 },
+        { OP_LDH,  0,         0,          ptp_src_port_offset + 8 },
+        { OP_XORX, 0,         0,          0 },
+        { OP_MUL,  0,         0,          0x9e3779b1 }, // Golden ratio
+        { OP_RSH,  0,         0,          16 },
+        { OP_MOD,  0,         0,          (uint32_t)m_shards },
+        { OP_RETA, 0,         0,          0 },
+    };
+    sock_fprog bpf = {
+        .len = sizeof(code) / sizeof(sock_filter),
+        .filter = (sock_filter *)code,
+    };
+    if(setsockopt(m_fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &bpf,
+            sizeof(bpf)) != 0)
+        return sysErr("SO_ATTACH_REUSEPORT_CBPF");
+    return true;
+}
+bool SockIp::initShards()
+{
+    int on = 1, off = 0;
+    for(size_t i = 1; i < m_shards; i++) {
+        int fd = socket(m_domain, SOCK_DGRAM, 0/*IPPROTO_UDP*/);
+        if(fd < 0)
+            return sysErr("socket");
+        m_shardFds.push_back(fd);
+        if(setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) != 0)
+            return sysErr("SO_REUSEADDR");
+        if(setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) != 0)
+            return sysErr("SO_REUSEPORT");
+        // Only the first shard receives multicast
+        int ret;
+        if(m_domain == AF_INET)
+            ret = setsockopt(fd, IPPROTO_IP, IP_MULTICAST_ALL, &off,
+                    sizeof(off));
+        else
+            ret = setsockopt(fd, IPPROTO_IPV6, IPV6_MULTICAST_ALL, &off,
+                    sizeof(off));
+        if(ret != 0)
+            return sysErr("MULTICAST_ALL");
+        if(setsockopt(fd, SOL_SOCKET, SO_BINDTODEVICE, m_ifName.c_str(),
+                m_ifName.length()) != 0)
+            return sysErr("BINDTODEVICE");
+        if(bind(fd, m_addr, m_addr_len) != 0)
+            return sysErr("bind");
+    }
+    return true;
+}
+ssize_t SockIp::rcvShard(size_t index, void *buf, size_t bufSize,
+    bool block) const
+{
+    int fd = getShardFd(index);
+    if(!m_isInit || fd < 0)
+        return -1;
+    int flags = MSG_TRUNC;
+    if(!block)
+        flags |= MSG_DONTWAIT;
+    ssize_t cnt = recv(fd, buf, bufSize, flags);
+    // Shards do not update the socket last error
+    if(cnt < 0) {
+        if(block || errno != EAGAIN)
+            logError({SOCK_ERR_SYS, errno, "recv", 0, 0});
+        return -1;
+    }
+    if(cnt > (ssize_t)bufSize) {
+        logError({SOCK_ERR_RCV_SIZE, 0, "rcv", cnt, bufSize});
+        return -1;
+    }
+    return cnt;
+}
 bool SockIp::setUdpTtl(uint8_t udp_ttl)
 {
     if(m_isInit)
@@ -317,25 +1259,45 @@ bool SockIp::sendBase(const void *msg, size_t len)
 {
     if(!m_isInit)
         return false;
-    ssize_t cnt = sendto(m_fd, msg, len, 0, m_addr, m_addr_len);
-    return sendReply(cnt, len);
+    preSendTs();
+    ssize_t cnt = sendto(m_fd, msg, len, m_sendFlags, m_addr, m_addr_len);
+    if(!sendReply(cnt, len))
+        return false;
+    sendTs();
+    return true;
+}
+size_t SockIp::sendBatchBase(const void *const *msgs, const size_t *lens,
+    size_t count)
+{
+    if(!m_isInit)
+        return 0;
+    if(m_queuePolicy != SOCK_QUEUE_NONE)
+        return SockBase::sendBatchBase(msgs, lens, count);
+    preSendTs();
+    size_t sent = sendMmsg(msgs, lens, count, m_addr, m_addr_len);
+    sendTs(sent);
+    return sent;
 }
 ssize_t SockIp::rcvBase(void *buf, size_t bufSize, bool block)
 {
     if(!m_isInit)
         return -1;
-    int flags = 0;
+    int flags = MSG_TRUNC;
     if(!block)
         flags |= MSG_DONTWAIT;
-    ssize_t cnt = recv(m_fd, buf, bufSize, flags);
-    if(cnt < 0) {
-        perror("recv");
+    iovec iov = { buf, bufSize };
+    msghdr msg = {0};
+    msg.msg_name = &m_from;
+    msg.msg_namelen = sizeof(m_from);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = m_ctrl;
+    msg.msg_controllen = sizeof(m_ctrl);
+    ssize_t cnt = rcvReply(recvmsg(m_fd, &msg, flags), bufSize, block);
+    if(cnt < 0)
         return -1;
-    }
-    if(cnt > (ssize_t)bufSize) {
-        fprintf(stderr, "rcv %zd more than buffer size %zu\n", cnt, bufSize);
-        return -1;
-    }
+    rcvCtrl(msg);
+    learnPeer(buf, cnt, msg.msg_namelen);
     return cnt;
 }
 bool SockIp::initBase()
@@ -344,29 +1306,24 @@ bool SockIp::initBase()
         return false;
     closeBase();
     m_fd = socket(m_domain, SOCK_DGRAM, 0/*IPPROTO_UDP*/);
-    if(m_fd < 0) {
-        perror("socket");
-        return false;
-    }
+    if(m_fd < 0)
+        return sysErr("socket");
     int on = 1;
-    if(setsockopt(m_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) != 0) {
-        perror("setsockopt SO_REUSEADDR failed: %m");
+    if(setsockopt(m_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) != 0)
+        return sysErr("SO_REUSEADDR");
+    if(m_shards > 1 && !initReusePort())
         return false;
-    }
-    if(bind(m_fd, m_addr, m_addr_len) != 0) {
-        perror("bind");
-        return false;
-    }
+    // Bind to device first, so all shards join the same reuse port group
     if(setsockopt(m_fd, SOL_SOCKET, SO_BINDTODEVICE, m_ifName.c_str(),
-            m_ifName.length()) != 0) {
-        perror("BINDTODEVICE");
+            m_ifName.length()) != 0)
+        return sysErr("BINDTODEVICE");
+    if(bind(m_fd, m_addr, m_addr_len) != 0)
+        return sysErr("bind");
+    if(m_shards > 1 && !initShards())
         return false;
-    }
-    if(!m_mcast.fromIp(m_mcast_str, m_domain)) {
-        fprintf(stderr, "multicast %s\n", m_mcast_str);
-        return false;
-    }
-    if(!init2())
+    if(!m_mcast.fromIp(m_mcast_str, m_domain))
+        return setErr(SOCK_ERR_PARAM, "multicast");
+    if(!init2() || !initTs() || (m_useFilter && !applyFilter()))
         return false;
     m_isInit = true;
     return true;
@@ -382,28 +1339,20 @@ SockIp4::SockIp4() : SockIp(AF_INET, ipv4_udp_mc, (sockaddr *) & m_addr4,
 bool SockIp4::init2()
 {
     if(setsockopt(m_fd, IPPROTO_IP, IP_MULTICAST_TTL, &m_udp_ttl,
-            sizeof(m_udp_ttl)) != 0) {
-        perror("IP_MULTICAST_TTL");
-        return false;
-    }
+            sizeof(m_udp_ttl)) != 0)
+        return sysErr("IP_MULTICAST_TTL");
     ip_mreqn req = {0};
     req.imr_multiaddr = *(in_addr *)m_mcast.get();
     req.imr_ifindex = m_ifIndex;
-    if(setsockopt(m_fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &req, sizeof(req)) != 0) {
-        perror("IP_ADD_MEMBERSHIP");
-        return false;
-    }
+    if(setsockopt(m_fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &req, sizeof(req)) != 0)
+        return sysErr("IP_ADD_MEMBERSHIP");
     int off = 0;
-    if(setsockopt(m_fd, IPPROTO_IP, IP_MULTICAST_LOOP, &off, sizeof(off)) != 0) {
-        perror("IP_MULTICAST_LOOP");
-        return false;
-    }
+    if(setsockopt(m_fd, IPPROTO_IP, IP_MULTICAST_LOOP, &off, sizeof(off)) != 0)
+        return sysErr("IP_MULTICAST_LOOP");
     req = {0};
     req.imr_ifindex = m_ifIndex;
-    if(setsockopt(m_fd, IPPROTO_IP, IP_MULTICAST_IF, &req, sizeof(req)) != 0) {
-        perror("IP_MULTICAST_IF");
-        return false;
-    }
+    if(setsockopt(m_fd, IPPROTO_IP, IP_MULTICAST_IF, &req, sizeof(req)) != 0)
+        return sysErr("IP_MULTICAST_IF");
     /* For sending */
     m_addr4.sin_addr = *(in_addr *)m_mcast.get();
     return true;
@@ -426,31 +1375,23 @@ bool SockIp6::init2()
     if(m_udp6_scope < 0)
         return false;
     if(setsockopt(m_fd, IPPROTO_IPV6, IPV6_MULTICAST_HOPS, &m_udp_ttl,
-            sizeof(m_udp_ttl)) != 0) {
-        perror("IPV6_MULTICAST_HOPS");
-        return false;
-    }
+            sizeof(m_udp_ttl)) != 0)
+        return sysErr("IPV6_MULTICAST_HOPS");
     m_mcast.setBin(1, m_udp6_scope);
     ipv6_mreq req = {0};
     req.ipv6mr_multiaddr = *(in6_addr *)m_mcast.get();
     req.ipv6mr_interface = m_ifIndex;
     if(setsockopt(m_fd, IPPROTO_IPV6, IPV6_ADD_MEMBERSHIP, &req,
-            sizeof(req)) != 0) {
-        perror("IPV6_ADD_MEMBERSHIP");
-        return false;
-    }
+            sizeof(req)) != 0)
+        return sysErr("IPV6_ADD_MEMBERSHIP");
     int off = 0;
     if(setsockopt(m_fd, IPPROTO_IPV6, IPV6_MULTICAST_LOOP, &off,
-            sizeof(off)) != 0) {
-        perror("IPV6_MULTICAST_LOOP");
-        return false;
-    }
+            sizeof(off)) != 0)
+        return sysErr("IPV6_MULTICAST_LOOP");
     req = {0};
     req.ipv6mr_interface = m_ifIndex;
-    if(setsockopt(m_fd, IPPROTO_IPV6, IPV6_MULTICAST_IF, &req, sizeof(req)) != 0) {
-        perror("IPV6_MULTICAST_IF");
-        return false;
-    }
+    if(setsockopt(m_fd, IPPROTO_IPV6, IPV6_MULTICAST_IF, &req, sizeof(req)) != 0)
+        return sysErr("IPV6_MULTICAST_IF");
     /* For sending */
     m_addr6.sin6_addr = *(in6_addr *)m_mcast.get();
     if(m_udp6_scope == 2)  // Local link
@@ -475,15 +1416,7 @@ bool SockIp6::setAllBase(ConfigFile &cfg, const std::string &section)
 {
     return setUdpTtl(cfg, section) && setScope(cfg, section);
 }
-SockRaw::SockRaw() :
-    m_socket_priority(-1),
-    m_addr{0},
-    m_msg_tx{0},
-    m_msg_rx{0},
-    m_hdr{0}
-{
-}
-bool SockRaw::setPtpDstMacStr(const std::string str)
+bool SockL2::setPtpDstMacStr(const std::string str)
 {
     if(m_isInit || str.empty())
         return false;
@@ -493,7 +1426,7 @@ bool SockRaw::setPtpDstMacStr(const std::string str)
     m_ptp_dst_mac = mac;
     return true;
 }
-bool SockRaw::setPtpDstMac(const Binary &ptp_dst_mac)
+bool SockL2::setPtpDstMac(const Binary &ptp_dst_mac)
 {
     size_t len = ptp_dst_mac.length();
     if(m_isInit || (len != EUI48 && len != EUI64))
@@ -501,20 +1434,28 @@ bool SockRaw::setPtpDstMac(const Binary &ptp_dst_mac)
     m_ptp_dst_mac = ptp_dst_mac;
     return true;
 }
-bool SockRaw::setPtpDstMac(const uint8_t *ptp_dst_mac, size_t len)
+bool SockL2::setPtpDstMac(const uint8_t *ptp_dst_mac, size_t len)
 {
     if(m_isInit || (len != EUI48 && len != EUI64))
         return false;
     m_ptp_dst_mac.setBin(ptp_dst_mac, len);
     return true;
 }
-bool SockRaw::setPtpDstMac(ConfigFile &cfg, const std::string section)
+bool SockL2::setPtpDstMac(ConfigFile &cfg, const std::string section)
 {
     if(m_isInit)
         return false;
     m_ptp_dst_mac = cfg.ptp_dst_mac(section);
     return true;
 }
+SockRaw::SockRaw() :
+    m_socket_priority(-1),
+    m_addr{0},
+    m_msg_tx{0},
+    m_msg_rx{0},
+    m_hdr{0}
+{
+}
 bool SockRaw::setSocketPriority(uint8_t socket_priority)
 {
     if(m_isInit || socket_priority < 0 || socket_priority > 15)
@@ -536,41 +1477,29 @@ bool SockRaw::initBase()
     uint16_t port_all = cpu_to_net16(ETH_P_ALL);
     uint16_t port_ptp = cpu_to_net16(ETH_P_1588);
     m_fd = socket(AF_PACKET, SOCK_RAW, port_all);
-    if(m_fd < 0) {
-        perror("socket");
-        return false;
-    }
+    if(m_fd < 0)
+        return sysErr("socket");
     m_addr.sll_ifindex = m_ifIndex;
     m_addr.sll_family = AF_PACKET;
     m_addr.sll_protocol = port_all;
-    if(bind(m_fd, (sockaddr *) &m_addr, sizeof(m_addr))) {
-        perror("bind");
-        return false;
-    }
+    if(bind(m_fd, (sockaddr *) &m_addr, sizeof(m_addr)))
+        return sysErr("bind");
     if(setsockopt(m_fd, SOL_SOCKET, SO_BINDTODEVICE, m_ifName.c_str(),
-            m_ifName.length()) != 0) {
-        perror("SO_BINDTODEVICE");
-        return false;
-    }
+            m_ifName.length()) != 0)
+        return sysErr("SO_BINDTODEVICE");
     if(setsockopt(m_fd, SOL_SOCKET, SO_PRIORITY, &m_socket_priority,
-            sizeof(m_socket_priority)) != 0) {
-        perror("SO_PRIORITY");
-        return false;
-    }
-    if(setsockopt(m_fd, SOL_SOCKET, SO_ATTACH_FILTER, &bpf, sizeof(bpf)) != 0) {
-        perror("SO_ATTACH_FILTER");
+            sizeof(m_socket_priority)) != 0)
+        return sysErr("SO_PRIORITY");
+    if(!applyFilter())
         return false;
-    }
     packet_mreq mreq = {0};
     mreq.mr_ifindex = m_ifIndex;
     mreq.mr_type = PACKET_MR_MULTICAST;
     mreq.mr_alen = m_ptp_dst_mac.length();
     m_ptp_dst_mac.copy(mreq.mr_address);
     if(setsockopt(m_fd, SOL_PACKET, PACKET_ADD_MEMBERSHIP, &mreq,
-            sizeof(mreq)) != 0) {
-        perror("PACKET_ADD_MEMBERSHIP ptp_dst_mac");
-        return false;
-    }
+            sizeof(mreq)) != 0)
+        return sysErr("PACKET_ADD_MEMBERSHIP ptp_dst_mac");
     // TX
     m_addr.sll_halen = m_ptp_dst_mac.length();
     m_ptp_dst_mac.copy(m_addr.sll_addr);
@@ -586,6 +1515,8 @@ bool SockRaw::initBase()
     // RX
     m_msg_rx.msg_iov = m_iov_rx;
     m_msg_rx.msg_iovlen = sizeof(m_iov_rx) / sizeof(iovec);
+    if(!initTs())
+        return false;
     m_isInit = true;
     return true;
 }
@@ -595,32 +1526,50 @@ bool SockRaw::sendBase(const void *msg, size_t len)
         return false;
     m_iov_tx[1].iov_base = (void *)msg;
     m_iov_tx[1].iov_len = len;
-    ssize_t cnt = sendmsg(m_fd, &m_msg_tx, 0);
-    return sendReply(cnt, len + sizeof(m_hdr));
+    preSendTs();
+    ssize_t cnt = sendmsg(m_fd, &m_msg_tx, m_sendFlags);
+    if(!sendReply(cnt, len + sizeof(m_hdr)))
+        return false;
+    sendTs();
+    return true;
+}
+size_t SockRaw::sendBatchBase(const void *const *msgs, const size_t *lens,
+    size_t count)
+{
+    if(!m_isInit)
+        return 0;
+    if(m_queuePolicy != SOCK_QUEUE_NONE)
+        return SockBase::sendBatchBase(msgs, lens, count);
+    preSendTs();
+    size_t sent = sendMmsg(msgs, lens, count, &m_addr, sizeof(m_addr),
+            &m_hdr, sizeof(m_hdr));
+    sendTs(sent);
+    return sent;
 }
 ssize_t SockRaw::rcvBase(void *buf, size_t bufSize, bool block)
 {
     if(!m_isInit)
         return -1;
-    int flags = 0;
+    int flags = MSG_TRUNC;
     if(!block)
         flags |= MSG_DONTWAIT;
     m_iov_rx[0].iov_base = m_rx_buf;
     m_iov_rx[0].iov_len = sizeof(m_rx_buf);
     m_iov_rx[1].iov_base = buf;
     m_iov_rx[1].iov_len = bufSize;
-    ssize_t cnt = recvmsg(m_fd, &m_msg_rx, flags);
-    if(cnt < 0) {
-        perror("recvmsg");
+    m_msg_rx.msg_control = m_ctrl;
+    m_msg_rx.msg_controllen = sizeof(m_ctrl);
+    ssize_t cnt = rcvReply(recvmsg(m_fd, &m_msg_rx, flags),
+            bufSize + sizeof(m_rx_buf), block, sizeof(m_rx_buf));
+    if(cnt < 0)
         return -1;
-    }
-    if(cnt > (ssize_t)(bufSize + sizeof(m_rx_buf))) {
-        fprintf(stderr, "rcv %zd more than buffer size %zu\n", cnt,
-            bufSize + sizeof(m_rx_buf));
-        return -1;
-    }
+    rcvCtrl(m_msg_rx);
     return cnt;
 }
+bool SockRaw::applyFilter()
+{
+    return attachFilter(m_fd, sizeof(ethhdr), true);
+}
 bool SockRaw::setAllBase(ConfigFile &cfg, const std::string &section)
 {
     return setPtpDstMac(cfg, section) && setSocketPriority(cfg, section);
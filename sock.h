@@ -7,25 +7,169 @@
  * @copyright 2021 Erez Geva
  *
  * @details
- *  provide 4 socket types:
+ *  provide 5 socket types:
  *  1. UDP using IP version 4
  *  2. UDP using IP version 6
  *  3. Raw Ethernet
- *  4. linuxptp Unix domain socket.
+ *  4. AF_XDP Ethernet
+ *  5. linuxptp Unix domain socket.
  */
 
 #ifndef __PMC_SOCK_H
 #define __PMC_SOCK_H
 
+#include <map>
+#include <deque>
+#include <memory>
 #include <string>
+#include <vector>
 #include <cstdint>
+#include <poll.h>
 #include <netinet/in.h>
 #include <sys/un.h>
+#include <sys/socket.h>
 #include <linux/if_packet.h>
 #include "cfg.h"
 #include "ptp.h"
 #include "bin.h"
 #include "buf.h"
+#include "rate.h"
+
+struct PortIdentity_t;
+
+/**
+ * @brief Kernel time stamps of a single frame
+ * @details
+ *  The software time stamp uses the system real time clock.
+ *  The hardware time stamp uses the network interface PTP hardware clock.
+ *  A zero value means the time stamp is not available.
+ */
+struct SockTimeStamp {
+    int64_t sw; /**< software time stamp in nanoseconds */
+    int64_t hw; /**< hardware time stamp in nanoseconds */
+};
+
+/**
+ * @brief Receive filter of PTP messages
+ * @details
+ *  The criteria are compiled into a socket filter, messages that do not
+ *  match are dropped by the kernel.
+ */
+struct PtpFilter {
+    /**
+     * Mask of message types to receive, bit per message type.
+     * i.e. (1 << Management) | (1 << Signaling). Zero receives any type.
+     */
+    uint16_t msgTypes;
+    int domainNumber; /**< domain number to receive or negative for any */
+    int sdoId; /**< sdoId to receive or negative for any */
+    /**
+     * Receive only messages sent to the target clock identity
+     * or to all clocks. The target is checked only on
+     * Management and Signaling messages.
+     */
+    bool useTarget;
+    uint8_t targetClock[8]; /**< target clock identity */
+    /**
+     * Receive only messages with sequence ID in range.
+     * The range wrap around if first is bigger than last.
+     */
+    bool useSequence;
+    uint16_t seqFirst; /**< first sequence ID in range */
+    uint16_t seqLast; /**< last sequence ID in range */
+    PtpFilter() : msgTypes(0), domainNumber(-1), sdoId(-1), useTarget(false),
+        targetClock{0}, useSequence(false), seqFirst(0), seqLast(0) {}
+};
+
+/**
+ * @brief Busy poll receive policy
+ * @details
+ *  Receive spins on non-blocking receive for a bounded time before
+ *  falling back to blocking wait. Reduce the latency of handling a reply
+ *  on the cost of CPU time.
+ */
+struct SockBusyPoll {
+    bool enable; /**< use busy poll receive */
+    /**
+     * Kernel busy poll time on receive in microseconds,
+     * set SO_BUSY_POLL. Zero leaves the socket default.
+     */
+    uint32_t busyPollUs;
+    bool preferBusyPoll; /**< set SO_PREFER_BUSY_POLL */
+    /**
+     * CPU to pin the receiving thread, negative for no pinning
+     */
+    int cpu;
+    uint32_t spinUs; /**< spin time in microseconds before blocking */
+    SockBusyPoll() : enable(false), busyPollUs(0), preferBusyPoll(false),
+        cpu(-1), spinUs(50) {}
+};
+
+/**
+ * @brief Socket statistics
+ */
+struct SockStats {
+    uint64_t rxPackets; /**< received messages */
+    /**
+     * messages dropped by the kernel as the receive queue was full
+     */
+    uint64_t rxDrops;
+    uint64_t rxErrors; /**< receive errors */
+    uint64_t rxShort; /**< received messages shorter than PTP header */
+    uint64_t rxOversized; /**< received messages bigger than buffer */
+    uint64_t txPackets; /**< sent messages */
+    uint64_t txErrors; /**< send errors */
+    uint64_t txQueued; /**< messages queued as the socket was busy */
+    uint64_t txQueueDrops; /**< queued messages dropped as queue was full */
+    /** messages delayed or rejected by the send rate limit */
+    uint64_t txThrottled;
+};
+
+/** Send queue policies */
+enum SockQueue_e {
+    SOCK_QUEUE_NONE,        /**< No queue, send blocks */
+    SOCK_QUEUE_DROP_OLDEST, /**< Drop oldest message when queue is full */
+    SOCK_QUEUE_BLOCK,       /**< Wait for socket when queue is full */
+};
+
+/** Socket error reasons */
+enum SockErr_e {
+    SOCK_ERR_NONE,         /**< No error */
+    SOCK_ERR_NOT_INIT,     /**< Socket is not initialized */
+    SOCK_ERR_SYS,          /**< System call failed, see errno value */
+    SOCK_ERR_PARAM,        /**< Wrong parameter value */
+    SOCK_ERR_SEND_SHORT,   /**< Message was sent partially */
+    SOCK_ERR_SEND_FULL,    /**< Transmit queue is full */
+    SOCK_ERR_SEND_SIZE,    /**< Message is bigger than frame */
+    SOCK_ERR_RCV_SIZE,     /**< Received message is bigger than buffer */
+    SOCK_ERR_RCV_PEER,     /**< Message from another address is discarded */
+    SOCK_ERR_NO_PEER,      /**< Peer address is unknown */
+    SOCK_ERR_SEND_RATE,    /**< Send rate limit exceeded */
+    SOCK_ERR_PEER_CLOSED,  /**< Peer socket is closed */
+};
+
+/**
+ * @brief Socket error
+ */
+struct SockError {
+    SockErr_e reason; /**< error reason */
+    int err; /**< errno value of system call or zero */
+    const char *op; /**< failed operation */
+    ssize_t cnt; /**< bytes sent or received */
+    size_t len; /**< bytes expected, message or buffer size */
+};
+
+#ifndef SWIG
+/**
+ * Socket error logger
+ * @param[in] err socket error
+ * @param[in] suppressed number of errors suppressed by rate limit
+ *  since last call
+ * @param[in] cookie user cookie
+ */
+typedef void (*SockLogFunc)(const SockError &err, uint32_t suppressed,
+    void *cookie);
+#endif /* SWIG */
 
 /**
  * @brief base class for all sockets
@@ -38,12 +182,50 @@ class SockBase
     /**< @cond internal */
     int m_fd;
     bool m_isInit;
-    SockBase() : m_fd(-1), m_isInit(false) {}
+    SockTimeStamp m_txTs; /* Time stamps of last sent frame */
+    SockTimeStamp m_rxTs; /* Time stamps of last received frame */
+    SockBusyPoll m_busy;
+    long m_pinTid; /* Thread pinned to CPU */
+    int m_rcvBufSize;
+    mutable SockStats m_stats; /* Updated by constant send and receive */
+    mutable SockError m_err; /* Last error */
+    SockQueue_e m_queuePolicy;
+    size_t m_queueMax;
+    std::deque<std::vector<uint8_t>> m_queue; /* Messages waiting to send */
+    int m_sendFlags; /* MSG_DONTWAIT while sending from queue */
+    TokenBucket m_rate; /* Send rate limit */
+    size_t m_rateReserved; /* Tokens taken for the next sends */
+    SockBase() : m_fd(-1), m_isInit(false), m_txTs{0}, m_rxTs{0},
+        m_pinTid(0), m_rcvBufSize(0), m_stats{0}, m_err{SOCK_ERR_NONE},
+        m_queuePolicy(SOCK_QUEUE_NONE), m_queueMax(0), m_sendFlags(0),
+        m_rateReserved(0) {}
+    bool sysErr(const char *op) const;
+    bool setErr(SockErr_e reason, const char *op, ssize_t cnt = 0,
+        size_t len = 0) const;
+    static void logError(const SockError &err);
     bool sendReply(ssize_t cnt, size_t len) const;
+    bool sendFull() const;
+    bool sendRate();
+    bool rateAllow(uint64_t now);
+    void rateTake(uint64_t now);
+    bool sendNoWait(const void *msg, size_t len);
+    bool sendQueue(const void *msg, size_t len);
+    size_t sendMmsg(const void *const *msgs, const size_t *lens,
+        size_t count, const void *name, socklen_t nameLen,
+        const void *hdr = nullptr, size_t hdrLen = 0);
+    virtual size_t sendBatchBase(const void *const *msgs, const size_t *lens,
+        size_t count);
+    ssize_t rcvReply(ssize_t cnt, size_t bufSize, bool block,
+        size_t hdrLen = 0) const;
+    virtual void statsBase();
+    bool initRcv();
+    bool initBusyPoll();
+    ssize_t rcvPolicy(void *buf, size_t bufSize, bool block);
     virtual bool sendBase(const void *msg, size_t len) = 0;
     virtual ssize_t rcvBase(void *buf, size_t bufSize, bool block) = 0;
     virtual bool initBase() = 0;
     virtual void closeBase();
+    virtual bool pollBase(uint64_t timeout_ms) const;
 
   public:
     virtual ~SockBase() { closeBase(); }
@@ -57,7 +239,7 @@ class SockBase
      * Allocate the socket and initialize it with current parameters
      * @return true if socket creation success
      */
-    bool init() { return initBase(); }
+    bool init() { return initBase() && initRcv() && initBusyPoll(); }
     /**
      * Send the message using the socket
      * @param[in] msg pointer to message memory buffer
@@ -67,7 +249,7 @@ class SockBase
      *  arrives its target. Only the network layer sends it.
      */
     bool send(const void *msg, size_t len)
-    { return sendBase(msg, len); }
+    { return sendQueue(msg, len); }
     /**
      * Send the message using the socket
      * @param[in] buf object with message memory buffer
@@ -77,7 +259,39 @@ class SockBase
      *  arrives its target. Only the network layer sends it.
      */
     bool send(Buf &buf, size_t len)
-    { return sendBase(buf.get(), len); }
+    { return sendQueue(buf.get(), len); }
+    /**
+     * Send the message using the socket and fetch its transmit time stamps
+     * @param[in] msg pointer to message memory buffer
+     * @param[in] len message length
+     * @param[out] txTs transmit time stamps
+     * @return true if message is sent
+     * @note time stamps are zero if time stamping is not enabled,
+     *  the message is queued, or the time stamp is not available yet
+     */
+    bool send(const void *msg, size_t len, SockTimeStamp &txTs) {
+        m_txTs = {0};
+        bool ret = sendQueue(msg, len);
+        txTs = m_txTs;
+        return ret;
+    }
+#ifndef SWIG
+    /**
+     * Send multiple messages using the socket
+     * @param[in] msgs pointers to messages memory buffers
+     * @param[in] lens messages lengths
+     * @param[in] count number of messages
+     * @return number of messages sent
+     * @note UDP, Raw and Unix sockets send the messages with
+     *  a single system call, unless send queue is used.
+     * @note the transmit time stamp is of the last message sent.
+     * @note sending stops on the first failure.
+     *  A message sent partially is counted as sent,
+     *  and its error is kept as the last error.
+     */
+    size_t send(const void *const *msgs, const size_t *lens, size_t count)
+    { return sendBatchBase(msgs, lens, count); }
+#endif /* SWIG */
     /**
      * Receive a message using the socket
      * @param[in, out] buf pointer to a memory buffer
@@ -88,7 +302,7 @@ class SockBase
      * @return number of bytes received or negative on failure
      */
     ssize_t rcv(void *buf, size_t bufSize, bool block = true)
-    { return rcvBase(buf, bufSize, block); }
+    { return rcvPolicy(buf, bufSize, block); }
     /**
      * Receive a message using the socket
      * @param[in, out] buf object with message memory buffer
@@ -98,7 +312,169 @@ class SockBase
      * @return number of bytes received or negative on failure
      */
     ssize_t rcv(Buf &buf, bool block = true)
-    { return rcvBase(buf.get(), buf.size(), block); }
+    { return rcvPolicy(buf.get(), buf.size(), block); }
+    /**
+     * Receive a message using the socket and fetch its receive time stamps
+     * @param[in, out] buf pointer to a memory buffer
+     * @param[in] bufSize memory buffer size
+     * @param[out] rxTs receive time stamps
+     * @param[in] block true, wait till a packet arrives.
+     *                  false, do not wait, return error
+     *                  if no packet available
+     * @return number of bytes received or negative on failure
+     * @note time stamps are zero if time stamping is not enabled
+     */
+    ssize_t rcv(void *buf, size_t bufSize, SockTimeStamp &rxTs,
+        bool block = true) {
+        ssize_t ret = rcvPolicy(buf, bufSize, block);
+        rxTs = m_rxTs;
+        return ret;
+    }
+    /**
+     * Get time stamps of last sent message
+     * @return transmit time stamps
+     * @note a time stamp that is not available when sending
+     *  is fetched by the following receive
+     */
+    const SockTimeStamp &getTxTimeStamp() const { return m_txTs; }
+    /**
+     * Get time stamps of last received message
+     * @return receive time stamps
+     */
+    const SockTimeStamp &getRxTimeStamp() const { return m_rxTs; }
+    /**
+     * Calculate round trip time of a request and its reply
+     * @param[in] tx transmit time stamps of the request
+     * @param[in] rx receive time stamps of the reply
+     * @return round trip time in nanoseconds or negative if not available
+     * @note hardware time stamps are used if both are available,
+     *  as software and hardware time stamps use different clocks
+     *  they are never mixed.
+     */
+    static int64_t rtt(const SockTimeStamp &tx, const SockTimeStamp &rx);
+    /**
+     * Set busy poll receive policy
+     * @param[in] policy busy poll policy
+     * @return true if policy is updated
+     * @note The policy is used by blocking receive and by polling.
+     * @note Setting SO_BUSY_POLL above the system net.core.busy_read
+     *  value requires CAP_NET_ADMIN capability.
+     * @note The thread calling a blocking receive is pinned to the CPU.
+     */
+    bool setBusyPoll(const SockBusyPoll &policy);
+    /**
+     * Get busy poll receive policy
+     * @return busy poll policy
+     */
+    const SockBusyPoll &getBusyPoll() const { return m_busy; }
+    /**
+     * Get last error
+     * @return last error
+     * @note the error is kept until the next error
+     */
+    const SockError &getLastError() const { return m_err; }
+    /**
+     * Get error reason description
+     * @param[in] reason error reason
+     * @return description string
+     */
+    static const char *errStr(SockErr_e reason);
+#ifndef SWIG
+    /**
+     * Set logger of socket errors of all sockets
+     * @param[in] func logger function or null to disable logging
+     * @param[in] cookie user cookie passed to the logger
+     * @note The default logger prints to standard error.
+     */
+    static void setLogger(SockLogFunc func, void *cookie = nullptr);
+#endif /* SWIG */
+    /**
+     * Set rate limit of socket errors logging
+     * @param[in] maxPerSec maximum errors to log per second,
+     *  zero for no limit
+     */
+    static void setLogRate(uint32_t maxPerSec);
+    /**
+     * Get socket statistics
+     * @return statistics
+     */
+    const SockStats &getStats() {
+        statsBase();
+        return m_stats;
+    }
+    /**
+     * Set socket receive buffer size
+     * @param[in] size buffer size in bytes
+     * @return true if size is updated
+     * @note Sizes above the system net.core.rmem_max value require
+     *  CAP_NET_ADMIN capability.
+     */
+    bool setRcvBufSize(int size);
+    /**
+     * Get socket receive buffer size
+     * @return buffer size in bytes as used by the kernel or
+     *  negative if socket is not initialized
+     * @note The kernel doubles the requested size for bookkeeping.
+     */
+    int getRcvBufSize() const;
+    /**
+     * Set send queue
+     * @param[in] policy queue policy
+     * @param[in] maxDepth maximum number of messages in queue
+     * @return true if queue is updated
+     * @note With a queue the socket sends without blocking, messages that
+     *  the socket can not send are queued and sent later.
+     *  Send returns true when a message is queued.
+     * @note Queued messages are sent by the next send or by flush().
+     *  Call flush() when the socket becomes writable.
+     * @note Transmit time stamps of queued messages are not available.
+     * @note Removing the queue drops the queued messages.
+     */
+    bool setSendQueue(SockQueue_e policy, size_t maxDepth = 64);
+    /**
+     * Get send queue policy
+     * @return queue policy
+     */
+    SockQueue_e getSendQueue() const { return m_queuePolicy; }
+    /**
+     * Get number of messages waiting in the send queue
+     * @return queue depth
+     */
+    size_t getQueueDepth() const { return m_queue.size(); }
+    /**
+     * Set send rate limit
+     * @param[in] rate messages per second, zero removes the limit
+     * @param[in] burst maximum messages sent at once
+     * @return true if limit is updated
+     * @note Without a send queue, messages above the limit fail
+     *  with SOCK_ERR_SEND_RATE. With a send queue, they are queued
+     *  and sent by flush() when the limit allows.
+     */
+    bool setRateLimit(uint64_t rate, uint64_t burst = 1);
+    /**
+     * Get send rate limit
+     * @return messages per second, zero if not limited
+     */
+    uint64_t getRateLimit() const { return m_rate.getRate(); }
+    /**
+     * Get time till the send rate limit allows a message
+     * @return microseconds, zero if a message can be sent
+     */
+    uint64_t getRateWait();
+    /**
+     * Reserve a token of the send rate limit
+     * @return true if a token is reserved or the socket is not limited
+     * @note The next sends use the reserved tokens, so a caller that
+     *  reserves a token for each message is not limited when it sends.
+     */
+    bool reserveRate();
+    /**
+     * Send queued messages
+     * @return true if the send queue is empty
+     * @note Call when polling of the socket file description
+     *  report it is writable (POLLOUT or EPOLLOUT).
+     */
+    bool flush();
     /**
      * Get socket file description
      * @return socket file description
@@ -116,7 +492,7 @@ class SockBase
      *  then fetch the file description with getFd()
      *  And implement it, or merge it into an existing polling
      */
-    bool poll(uint64_t timeout_ms = 0) const;
+    bool poll(uint64_t timeout_ms = 0) const { return pollBase(timeout_ms); }
     /**
      * Single socket polling and update timeout
      * @param[in, out] timeout_ms timeout in milliseconds
@@ -148,10 +524,14 @@ class SockUnix : public SockBase
     sockaddr_un m_peerAddr;
     bool setPeerInternal(const std::string &str);
     bool sendAny(const void *msg, size_t len, const sockaddr_un &addr) const;
+    ssize_t rcvAny(void *buf, size_t bufSize, sockaddr_un &addr,
+        socklen_t &addrLen, bool block) const;
     static void setUnixAddr(sockaddr_un &addr, const std::string &str);
   protected:
     /**< @cond internal */
     bool sendBase(const void *msg, size_t len);
+    size_t sendBatchBase(const void *const *msgs, const size_t *lens,
+        size_t count);
     ssize_t rcvBase(void *buf, size_t bufSize, bool block);
     bool initBase();
     void closeBase();
@@ -316,13 +696,69 @@ class SockBaseIf : public SockBase
     std::string m_ifName; /* interface to use */
     Binary m_mac;
     int m_ifIndex;
+    int m_ptpIndex;
     bool m_have_if;
+    bool m_useTs; /* Time stamping requested */
+    bool m_hwTxTs; /* Use hardware transmit time stamp */
+    bool m_txTsWait; /* Last sent frame time stamp is not received */
+    uint32_t m_txTsMiss; /* Hardware time stamps missed in a row */
+    uint32_t m_txTsKey; /* Time stamp key of next sent frame */
+    bool m_useFilter;
+    PtpFilter m_filter;
+    alignas(cmsghdr) uint8_t m_ctrl[256]; /* Control messages buffer */
     bool setInt(IfInfo &ifObj);
-    SockBaseIf() : m_have_if(false) {}
+    SockBaseIf() : m_ptpIndex(-1), m_have_if(false), m_useTs(false),
+        m_hwTxTs(false), m_txTsWait(false), m_txTsMiss(0), m_txTsKey(0),
+        m_useFilter(false) {}
     virtual bool setAllBase(ConfigFile &cfg, const std::string &section) = 0;
+    virtual bool applyFilter() { return true; }
+    bool attachFilter(int fd, size_t offset, bool ether);
+    bool initTs();
+    void rcvCtrl(msghdr &msg);
+    void preSendTs();
+    void sendTs(size_t frames = 1);
+    void rcvTxTs();
     /**< @endcond */
 
   public:
+    /**
+     * Enable kernel time stamping of sent and received messages
+     * @param[in] enable true to enable time stamping
+     * @return true if time stamping is updated
+     * @note Software time stamps are always used. Hardware time stamps are
+     *  used when the network interface have a PTP hardware clock.
+     *  The library does not configure the network interface hardware
+     *  time stamping, the PTP daemon is expected to do it.
+     * @note Sending a message does not wait for the transmit time stamp.
+     *  A late time stamp is fetched by the following receive,
+     *  see getTxTimeStamp(). If the network interface misses several
+     *  hardware transmit time stamps in a row, the socket falls back to
+     *  software transmit time stamps.
+     * @note time stamping is supported by UDP and Raw sockets.
+     * @note time stamping can not be changed after initializing.
+     *  User can close the socket, change this value, and
+     *  initialize a new socket.
+     */
+    bool setTimeStamping(bool enable);
+    /**
+     * Query if kernel time stamping is requested
+     * @return true if time stamping is requested
+     */
+    bool isTimeStamping() const { return m_useTs; }
+    /**
+     * Set receive filter
+     * @param[in] filter receive criteria
+     * @return true if filter is updated
+     * @note the filter can be changed after initializing,
+     *  i.e. to move the sequence range.
+     * @note filter is supported by UDP and Raw sockets.
+     */
+    bool setFilter(const PtpFilter &filter);
+    /**
+     * Remove receive filter
+     * @return true if filter is removed
+     */
+    bool clearFilter();
     /**
      * Set network interface using its name
      * @param[in] ifName interface name
@@ -379,7 +815,7 @@ class SockBaseIf : public SockBase
      */
     bool setAllInit(IfInfo &ifObj, ConfigFile &cfg,
         const std::string section = "") {
-        return setAll(ifObj, cfg, section) && initBase();
+        return setAll(ifObj, cfg, section) && init();
     }
 };
 
@@ -391,6 +827,22 @@ class SockBaseIf : public SockBase
  */
 class SockIp : public SockBaseIf
 {
+  private:
+    /* Peer address learned from received messages */
+    struct PeerAddr {
+        sockaddr_storage addr;
+        socklen_t len;
+    };
+    /* Key is clock identity and port number */
+    typedef std::pair<uint64_t, uint16_t> PeerKey;
+    std::map<PeerKey, PeerAddr> m_peers;
+    sockaddr_storage m_from;
+    size_t m_shards;
+    std::vector<int> m_shardFds; /* Sockets of shards, beside the first */
+    void learnPeer(const void *buf, size_t len, socklen_t addrLen);
+    bool initReusePort();
+    bool initShards();
+
   protected:
     /**< @cond internal */
     int m_domain;
@@ -403,11 +855,131 @@ class SockIp : public SockBaseIf
     SockIp(int domain, const char *mcast, sockaddr *addr, size_t len);
     virtual bool init2() = 0;
     bool sendBase(const void *msg, size_t len);
+    size_t sendBatchBase(const void *const *msgs, const size_t *lens,
+        size_t count);
     ssize_t rcvBase(void *buf, size_t bufSize, bool block);
     bool initBase();
+    void closeBase();
+    bool applyFilter();
     /**< @endcond */
 
   public:
+    /**< @cond internal */
+    ~SockIp() { closeBase(); }
+    /**< @endcond */
+    /**
+     * Send the message using unicast to a peer
+     * @param[in] msg pointer to message memory buffer
+     * @param[in] len message length
+     * @param[in] peer port identity of the peer
+     * @return true if message is sent
+     * @note The peer address is learned from messages the peer sent,
+     *  and received using this socket.
+     * @note The function sets the unicast flag in the message,
+     *  so the peer reply using unicast as well.
+     * @note The message uses the socket rate limit. It is not queued,
+     *  it fails if the rate limit does not allow it
+     *  or if queued messages can not be sent first.
+     * @note true does @b NOT guarantee the frame was successfully
+     *  arrives its target. Only the network layer sends it.
+     */
+    bool sendTo(const void *msg, size_t len, const PortIdentity_t &peer);
+    /**
+     * Send the message using unicast to a peer
+     * @param[in] buf object with message memory buffer
+     * @param[in] len message length
+     * @param[in] peer port identity of the peer
+     * @return true if message is sent
+     * @note The peer address is learned from messages the peer sent,
+     *  and received using this socket.
+     * @note The function sets the unicast flag in the message,
+     *  so the peer reply using unicast as well.
+     * @note The message uses the socket rate limit. It is not queued,
+     *  it fails if the rate limit does not allow it
+     *  or if queued messages can not be sent first.
+     * @note true does @b NOT guarantee the frame was successfully
+     *  arrives its target. Only the network layer sends it.
+     */
+    bool sendTo(Buf &buf, size_t len, const PortIdentity_t &peer)
+    { return sendTo(buf.get(), len, peer); }
+    /**
+     * Query if the peer address is known
+     * @param[in] peer port identity of the peer
+     * @return true if peer address was learned
+     */
+    bool havePeer(const PortIdentity_t &peer) const;
+    /**
+     * Get number of peers with known address
+     * @return number of peers
+     */
+    size_t getPeersCount() const { return m_peers.size(); }
+    /**
+     * Remove a peer address
+     * @param[in] peer port identity of the peer
+     */
+    void removePeer(const PortIdentity_t &peer);
+    /**
+     * Remove all peers addresses
+     */
+    void clearPeers() { m_peers.clear(); }
+    /**
+     * Set number of receive shards
+     * @param[in] shards number of sockets to open
+     * @return true if number of shards is updated
+     * @details
+     *  Open multiple sockets bound to the PTP port with SO_REUSEPORT.
+     *  The kernel selects the receiving socket using a hash of the message
+     *  source port identity. Messages from the same clock are always
+     *  received by the same shard, so each shard can be served
+     *  by a separate thread.
+     * @note The first shard is the socket used by send() and rcv().
+     *  Multicast messages are received by the first shard only,
+     *  use sendTo() so the clocks reply using unicast.
+     * @note shards number can not be changed after initializing.
+     *  User can close the socket, change this value, and
+     *  initialize a new socket.
+     */
+    bool setShards(size_t shards);
+    /**
+     * Get number of receive shards
+     * @return number of shards
+     */
+    size_t getShards() const { return m_shards; }
+    /**
+     * Get shard socket file description
+     * @param[in] index shard index
+     * @return socket file description or negative if index is out of range
+     * @note Can be used to poll the shard.
+     *  Do @b NOT free the socket.
+     */
+    int getShardFd(size_t index) const;
+    /**
+     * Receive a message using a shard socket
+     * @param[in] index shard index
+     * @param[in, out] buf pointer to a memory buffer
+     * @param[in] bufSize memory buffer size
+     * @param[in] block true, wait till a packet arrives.
+     *                  false, do not wait, return error
+     *                  if no packet available
+     * @return number of bytes received or negative on failure
+     * @note The function is thread safe, each thread should use
+     *  a different shard. Peer addresses and time stamps are not updated.
+     */
+    ssize_t rcvShard(size_t index, void *buf, size_t bufSize,
+        bool block = true) const;
+    /**
+     * Receive a message using a shard socket
+     * @param[in] index shard index
+     * @param[in, out] buf object with message memory buffer
+     * @param[in] block true, wait till a packet arrives.
+     *                  false, do not wait, return error
+     *                  if no packet available
+     * @return number of bytes received or negative on failure
+     * @note The function is thread safe, each thread should use
+     *  a different shard. Peer addresses and time stamps are not updated.
+     */
+    ssize_t rcvShard(size_t index, Buf &buf, bool block = true) const
+    { return rcvShard(index, buf.get(), buf.size(), block); }
     /**
      * Set IP ttl value
      * @param[in] udp_ttl IP time to live
@@ -491,30 +1063,20 @@ class SockIp6 : public SockIp
 };
 
 /**
- * @brief Raw socket that uses PTP over Ethernet
- * @note The class does @b NOT support VLAN tags!
+ * @brief base for sockets that use PTP over Ethernet
+ * @details
+ *  provide functions to set the PTP multicast address for
+ *  Raw and AF_XDP sockets.
  */
-class SockRaw : public SockBaseIf
+class SockL2 : public SockBaseIf
 {
-  private:
-    Binary m_ptp_dst_mac;
-    int m_socket_priority;
-    sockaddr_ll m_addr;
-    iovec m_iov_tx[2], m_iov_rx[2];
-    msghdr m_msg_tx, m_msg_rx;
-    ethhdr m_hdr;
-    uint8_t m_rx_buf[sizeof(ethhdr)];
-
   protected:
     /**< @cond internal */
-    bool setAllBase(ConfigFile &cfg, const std::string &section);
-    bool sendBase(const void *msg, size_t len);
-    ssize_t rcvBase(void *buf, size_t bufSize, bool block);
-    bool initBase();
+    Binary m_ptp_dst_mac;
+    SockL2() {}
+    /**< @endcond */
 
   public:
-    SockRaw();
-    /**< @endcond */
     /**
      * Set PTP multicast address using string from
      * @param[in] string address in a string object
@@ -556,6 +1118,35 @@ class SockRaw : public SockBaseIf
      * @note calling without section will fetch value from @"global@" section
      */
     bool setPtpDstMac(ConfigFile &cfg, const std::string section = "");
+};
+
+/**
+ * @brief Raw socket that uses PTP over Ethernet
+ * @note The class does @b NOT support VLAN tags!
+ */
+class SockRaw : public SockL2
+{
+  private:
+    int m_socket_priority;
+    sockaddr_ll m_addr;
+    iovec m_iov_tx[2], m_iov_rx[2];
+    msghdr m_msg_tx, m_msg_rx;
+    ethhdr m_hdr;
+    uint8_t m_rx_buf[sizeof(ethhdr)];
+
+  protected:
+    /**< @cond internal */
+    bool setAllBase(ConfigFile &cfg, const std::string &section);
+    bool sendBase(const void *msg, size_t len);
+    size_t sendBatchBase(const void *const *msgs, const size_t *lens,
+        size_t count);
+    ssize_t rcvBase(void *buf, size_t bufSize, bool block);
+    bool initBase();
+    bool applyFilter();
+
+  public:
+    SockRaw();
+    /**< @endcond */
     /**
      * Set socket priority
      * @param[in] socket_priority socket priority value
@@ -580,4 +1171,324 @@ class SockRaw : public SockBaseIf
     bool setSocketPriority(ConfigFile &cfg, const std::string section = "");
 };
 
+/**
+ * @brief AF_XDP socket that uses PTP over Ethernet
+ * @details
+ *  Receive PTP frames using an AF_XDP socket, the kernel network stack is
+ *  bypassed. An XDP program redirect only frames with PTP ethernet protocol
+ *  to the socket, all other frames pass to the kernel network stack.
+ *  The socket use zero-copy mode, if requested and the network driver
+ *  support it, otherwise it use copy mode.
+ * @note The class does @b NOT support VLAN tags!
+ * @note The class does @b NOT support receive filter.
+ * @note The XDP program is attached to the network interface while
+ *  the socket is open. Only a single XDP program can be attached to
+ *  a network interface.
+ * @note The socket is bound to a single receive queue of the
+ *  network interface. PTP frames that arrive on other queues are passed to
+ *  the kernel network stack. Use the network interface flow steering to
+ *  direct PTP frames to the socket queue.
+ */
+class SockXdp : public SockL2
+{
+  private:
+    /* Single producer single consumer ring shared with kernel */
+    struct XdpRing {
+        uint32_t *producer;
+        uint32_t *consumer;
+        uint32_t *flags;
+        void *ring;
+        void *map;
+        size_t mapLen;
+        uint32_t mask;
+    };
+    uint32_t m_queue;
+    bool m_zeroCopy;
+    bool m_useZeroCopy;
+    int m_mapFd;
+    int m_progFd;
+    int m_linkFd;
+    uint8_t *m_umem;
+    size_t m_umemLen;
+    XdpRing m_rx, m_tx, m_fill, m_comp;
+    std::vector<uint64_t> m_txFree;
+    ethhdr m_hdr;
+    bool mapRing(XdpRing &ring, const void *offsets, size_t descSize,
+        uint64_t pgoff);
+    void unmapRing(XdpRing &ring);
+    bool initSock();
+    bool loadProg();
+    void reapTx();
+
+  protected:
+    /**< @cond internal */
+    bool setAllBase(ConfigFile &cfg, const std::string &section);
+    bool sendBase(const void *msg, size_t len);
+    ssize_t rcvBase(void *buf, size_t bufSize, bool block);
+    bool initBase();
+    void closeBase();
+    void statsBase();
+
+  public:
+    SockXdp();
+    ~SockXdp() { closeBase(); }
+    /**< @endcond */
+    /**
+     * Set network interface receive queue
+     * @param[in] queue receive queue index
+     * @return true if receive queue is updated
+     * @note receive queue can not be changed after initializing.
+     *  User can close the socket, change this value, and
+     *  initialize a new socket.
+     */
+    bool setQueue(uint32_t queue);
+    /**
+     * Get network interface receive queue
+     * @return receive queue index
+     */
+    uint32_t getQueue() const { return m_queue; }
+    /**
+     * Request zero-copy mode
+     * @param[in] zeroCopy true to try zero-copy mode before copy mode
+     * @return true if request is updated
+     * @note zero-copy mode request can not be changed after initializing.
+     *  User can close the socket, change this value, and
+     *  initialize a new socket.
+     */
+    bool setZeroCopy(bool zeroCopy);
+    /**
+     * Query if socket uses zero-copy mode
+     * @return true if socket is initialized and uses zero-copy mode
+     */
+    bool isZeroCopy() const { return m_isInit && m_useZeroCopy; }
+};
+
+/**
+ * @brief In memory socket
+ * @details
+ *  Connect two sockets in the same process without the kernel network
+ *  stack. Used to benchmark and test clients, proxies and responders.
+ *  Each direction uses a lock-free single producer single consumer ring.
+ *  Optionally the sockets use a socket pair, which provide a file
+ *  description that can be merged into an existing polling.
+ * @note Each socket may be used by a single sending thread and
+ *  a single receiving thread.
+ * @note Ring sockets do not have a file description, getFd() returns -1.
+ * @note The socket does not support time stamping.
+ */
+class SockMem : public SockBase
+{
+  private:
+    struct Link;
+    std::shared_ptr<Link> m_link;
+    int m_side; /* Our side of the link */
+    size_t m_slots;
+    size_t m_slotSize;
+    bool m_pollable;
+
+  protected:
+    /**< @cond internal */
+    bool sendBase(const void *msg, size_t len);
+    ssize_t rcvBase(void *buf, size_t bufSize, bool block);
+    bool initBase();
+    void closeBase();
+    bool pollBase(uint64_t timeout_ms) const;
+
+  public:
+    SockMem() : m_side(0), m_slots(1024), m_slotSize(2048),
+        m_pollable(false) {}
+    ~SockMem() { closeBase(); }
+    /**< @endcond */
+    /**
+     * Set ring size
+     * @param[in] slots number of messages in each ring, power of 2
+     * @param[in] slotSize maximum message size
+     * @return true if ring size is updated
+     * @note ring size can not be changed after connecting.
+     */
+    bool setRingSize(size_t slots, size_t slotSize);
+    /**
+     * Get number of messages in each ring
+     * @return number of messages
+     */
+    size_t getRingSlots() const { return m_slots; }
+    /**
+     * Get maximum message size
+     * @return maximum message size
+     */
+    size_t getSlotSize() const { return m_slotSize; }
+    /**
+     * Use socket pair instead of rings
+     * @param[in] pollable true to use a socket pair
+     * @return true if request is updated
+     * @note can not be changed after connecting.
+     */
+    bool setPollable(bool pollable);
+    /**
+     * Query if socket uses a socket pair
+     * @return true if socket uses a socket pair
+     */
+    bool isPollable() const { return m_pollable; }
+    /**
+     * Connect to a peer socket
+     * @param[in, out] peer socket
+     * @return true if sockets are connected
+     * @note The peer uses this socket ring size and socket pair setting.
+     * @note Both sockets should be initialized after connecting.
+     *  Closing a socket release its side of the connection,
+     *  connect again before initializing it.
+     */
+    bool connect(SockMem &peer);
+};
+
+/**
+ * @brief Group of sockets on multiple network interfaces
+ * @details
+ *  Open the same transport on a list of network interfaces and
+ *  receive from all of them in a single loop.
+ *  Used to manage all ports of a boundary clock from a single thread.
+ */
+class SockGroup
+{
+  private:
+    struct Member {
+        IfInfo ifObj;
+        std::unique_ptr<SockBaseIf> sock;
+    };
+    char m_transport;
+    bool m_isInit;
+    std::vector<Member> m_members;
+    std::vector<pollfd> m_pfds;
+    size_t m_next; /* Round robin start of receive */
+    size_t m_rcvIndex; /* Interface of last received frame */
+
+  public:
+    SockGroup() : m_transport('4'), m_isInit(false), m_next(0),
+        m_rcvIndex(0) {}
+    ~SockGroup() { close(); }
+    /**
+     * Set transport used on all network interfaces
+     * @param[in] transport '4' for UDP over IPv4, '6' for UDP over IPv6
+     *  and '2' for PTP over Ethernet, as network_transport
+     *  in configuration file
+     * @return true if transport is updated
+     * @note transport can not be changed after adding interfaces.
+     */
+    bool setTransport(char transport);
+    /**
+     * Get transport used on all network interfaces
+     * @return transport
+     */
+    char getTransport() const { return m_transport; }
+    /**
+     * Add network interface using a network interface object
+     * @param[in] ifObj initialized network interface object
+     * @return true if network interface is added
+     * @note interfaces can not be added after initializing.
+     */
+    bool addIf(const IfInfo &ifObj);
+    /**
+     * Add network interface using its name
+     * @param[in] ifName interface name
+     * @return true if network interface is added
+     * @note interfaces can not be added after initializing.
+     */
+    bool addIfUsingName(const std::string &ifName);
+    /**
+     * Add all network interfaces with a PTP hardware clock
+     * @return number of network interfaces added
+     * @note interfaces can not be added after initializing.
+     */
+    size_t addAllPtp();
+    /**
+     * Get number of network interfaces
+     * @return number of network interfaces
+     */
+    size_t size() const { return m_members.size(); }
+    /**
+     * Get socket of a network interface
+     * @param[in] index of network interface
+     * @return socket or null if index is wrong
+     * @note use to set socket parameters before initializing.
+     */
+    SockBaseIf *getSock(size_t index);
+    /**
+     * Get network interface object
+     * @param[in] index of network interface
+     * @return network interface object or null if index is wrong
+     */
+    const IfInfo *getIf(size_t index) const;
+    /**
+     * Initialize all sockets using a configuration file
+     * @param[in] cfg reference to configuration file object
+     * @return true if all sockets are initialized
+     * @note each socket uses the section of its network interface
+     */
+    bool init(ConfigFile &cfg);
+    /**
+     * Initialize all sockets using default configuration
+     * @return true if all sockets are initialized
+     */
+    bool init();
+    /**
+     * Close all sockets
+     */
+    void close();
+    /**
+     * Send the message on a single network interface
+     * @param[in] index of network interface
+     * @param[in] msg pointer to message memory buffer
+     * @param[in] len message length
+     * @return true if message is sent
+     */
+    bool send(size_t index, const void *msg, size_t len);
+    /**
+     * Send the message on a single network interface
+     * @param[in] index of network interface
+     * @param[in] buf object with message memory buffer
+     * @param[in] len message length
+     * @return true if message is sent
+     */
+    bool send(size_t index, Buf &buf, size_t len)
+    { return send(index, buf.get(), len); }
+    /**
+     * Send the message on all network interfaces
+     * @param[in] msg pointer to message memory buffer
+     * @param[in] len message length
+     * @return number of network interfaces the message is sent on
+     */
+    size_t sendAll(const void *msg, size_t len);
+    /**
+     * Send the message on all network interfaces
+     * @param[in] buf object with message memory buffer
+     * @param[in] len message length
+     * @return number of network interfaces the message is sent on
+     */
+    size_t sendAll(Buf &buf, size_t len) { return sendAll(buf.get(), len); }
+    /**
+     * Receive a message from any network interface
+     * @param[in, out] buf pointer to a memory buffer
+     * @param[in] bufSize memory buffer size
+     * @param[in] timeout_ms timeout in milliseconds,
+     *  until receive a packet. use 0 for blocking.
+     * @return number of bytes received or negative on failure or timeout
+     * @note interfaces are served in round robin.
+     */
+    ssize_t rcv(void *buf, size_t bufSize, uint64_t timeout_ms = 0);
+    /**
+     * Receive a message from any network interface
+     * @param[in, out] buf object with message memory buffer
+     * @param[in] timeout_ms timeout in milliseconds,
+     *  until receive a packet. use 0 for blocking.
+     * @return number of bytes received or negative on failure or timeout
+     */
+    ssize_t rcv(Buf &buf, uint64_t timeout_ms = 0)
+    { return rcv(buf.get(), buf.size(), timeout_ms); }
+    /**
+     * Get network interface of last received message
+     * @return index of network interface
+     */
+    size_t getRcvIndex() const { return m_rcvIndex; }
+};
+
 #endif /*__PMC_SOCK_H*/
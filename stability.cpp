@@ -0,0 +1,190 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+
+/** @file
+ * @brief Clock stability statistics
+ *
+ * @author Erez Geva <ErezGeva2@@gmail.com>
+ * @copyright 2021 Erez Geva
+ *
+ */
+
+#include <cmath>
+#include <cstring>
+#include "stability.h"
+
+ClockStability::ClockStability(double tau0, size_t levels) :
+    m_tau0(tau0),
+    m_samples(0),
+    m_levels(levels > 0 ? (levels < 64 ? levels : 63) : 1)
+{
+    reset();
+}
+void ClockStability::reset()
+{
+    m_samples = 0;
+    for(Level &l : m_levels)
+        memset(&l, 0, sizeof l);
+}
+void ClockStability::add(int64_t offset)
+{
+    m_samples++;
+    Block block = { (double)offset, offset, offset, offset };
+    add(0, block);
+}
+void ClockStability::add(size_t level, const Block &block)
+{
+    Level &l = m_levels[level];
+    double mean = block.sum / (double)((uint64_t)1 << level);
+    if(l.blocks > 0) {
+        // Window from previous block start to this block start
+        int64_t max = l.last.max > block.first ? l.last.max : block.first;
+        int64_t min = l.last.min < block.first ? l.last.min : block.first;
+        if(max - min > l.mtie)
+            l.mtie = max - min;
+    }
+    if(l.blocks > 1) {
+        double d = (double)block.first - 2 * (double)l.x1 + (double)l.x2;
+        l.sumAdev += d * d;
+        d = mean - 2 * l.m1 + l.m2;
+        l.sumTdev += d * d;
+        l.terms++;
+    }
+    l.x2 = l.x1;
+    l.x1 = block.first;
+    l.m2 = l.m1;
+    l.m1 = mean;
+    l.last = block;
+    l.blocks++;
+    if(level + 1 >= m_levels.size())
+        return;
+    if(!l.hasPending) {
+        l.pending = block;
+        l.hasPending = true;
+        return;
+    }
+    l.hasPending = false;
+    Block next;
+    next.sum = l.pending.sum + block.sum;
+    next.min = l.pending.min < block.min ? l.pending.min : block.min;
+    next.max = l.pending.max > block.max ? l.pending.max : block.max;
+    next.first = l.pending.first;
+    add(level + 1, next);
+}
+StabilityPoint ClockStability::getPoint(size_t level) const
+{
+    StabilityPoint point = {0};
+    if(level >= m_levels.size())
+        return point;
+    const Level &l = m_levels[level];
+    point.tau = m_tau0 * (double)((uint64_t)1 << level);
+    point.terms = l.terms;
+    point.mtie = l.mtie;
+    if(l.terms > 0) {
+        double tau = point.tau * 1e9; // In nanoseconds
+        point.adev = sqrt(l.sumAdev / l.terms / 2) / tau;
+        point.tdev = sqrt(l.sumTdev / l.terms / 6);
+    }
+    return point;
+}
+std::vector<StabilityPoint> ClockStability::getPoints() const
+{
+    std::vector<StabilityPoint> points;
+    for(size_t i = 0; i < m_levels.size() && m_levels[i].terms > 0; i++)
+        points.push_back(getPoint(i));
+    return points;
+}
+StabilityMonitor::StabilityMonitor(double pollInterval, size_t levels) :
+    m_pollInterval(pollInterval),
+    m_syncInterval(1),
+    m_levels(levels)
+{
+}
+bool StabilityMonitor::setSyncInterval(double interval)
+{
+    if(!(interval > 0))
+        return false;
+    m_syncInterval = interval;
+    return true;
+}
+StabilityMonitor::Clock &StabilityMonitor::node(const ClockIdentity_t &clock,
+    bool sync)
+{
+    uint64_t key;
+    memcpy(&key, clock.v, sizeof key);
+    auto it = m_clocks.find(key);
+    if(it == m_clocks.end()) {
+        Clock c = {ClockStability(sync ? m_syncInterval : m_pollInterval,
+                m_levels), sync
+            };
+        return m_clocks.emplace(key, c).first->second;
+    }
+    Clock &c = it->second;
+    if(sync && !c.sync) {
+        // Synchronization timing data replaces polled offsets
+        c.stability = ClockStability(m_syncInterval, m_levels);
+        c.sync = true;
+    }
+    return c;
+}
+size_t StabilityMonitor::feed(const Message &msg)
+{
+    if(!msg.isLastMsgSig())
+        return feed(msg.getPeer(), msg.getTlvId(), msg.getData());
+    size_t count = 0;
+    for(size_t i = 0; i < msg.getSigTlvsCount(); i++) {
+        if(msg.getSigTlvType(i) == SLAVE_RX_SYNC_TIMING_DATA) {
+            const SLAVE_RX_SYNC_TIMING_DATA_t *data =
+                static_cast<const SLAVE_RX_SYNC_TIMING_DATA_t *>
+                (msg.getSigTlv(i));
+            if(data != nullptr)
+                count += feed(msg.getPeer(), *data);
+        }
+    }
+    return count;
+}
+size_t StabilityMonitor::feed(const PortIdentity_t &peer, mng_vals_e id,
+    const BaseMngTlv *data)
+{
+    if(id != TIME_STATUS_NP || data == nullptr)
+        return 0;
+    Clock &c = node(peer.clockIdentity, false);
+    if(c.sync)
+        return 0;
+    const TIME_STATUS_NP_t &d = *static_cast<const TIME_STATUS_NP_t *>(data);
+    c.stability.add(d.master_offset);
+    return 1;
+}
+size_t StabilityMonitor::feed(const PortIdentity_t &peer,
+    const SLAVE_RX_SYNC_TIMING_DATA_t &data)
+{
+    if(data.list.empty())
+        return 0;
+    Clock &c = node(peer.clockIdentity, true);
+    for(const auto &rec : data.list) {
+        // Fixed path delay does not change the statistics
+        int64_t sec = (int64_t)rec.syncEventIngressTimestamp.secondsField -
+            (int64_t)rec.syncOriginTimestamp.secondsField;
+        int64_t nsec =
+            (int64_t)rec.syncEventIngressTimestamp.nanosecondsField -
+            (int64_t)rec.syncOriginTimestamp.nanosecondsField;
+        c.stability.add(sec * 1000000000 + nsec -
+            rec.totalCorrectionField.getIntervalInt());
+    }
+    return data.list.size();
+}
+const ClockStability *StabilityMonitor::get(const ClockIdentity_t &clock)
+const
+{
+    uint64_t key;
+    memcpy(&key, clock.v, sizeof key);
+    auto it = m_clocks.find(key);
+    if(it == m_clocks.end())
+        return nullptr;
+    return &it->second.stability;
+}
+bool StabilityMonitor::remove(const ClockIdentity_t &clock)
+{
+    uint64_t key;
+    memcpy(&key, clock.v, sizeof key);
+    return m_clocks.erase(key) > 0;
+}
@@ -0,0 +1,192 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+
+/** @file
+ * @brief Clock stability statistics
+ *
+ * @author Erez Geva <ErezGeva2@@gmail.com>
+ * @copyright 2021 Erez Geva
+ *
+ */
+
+#ifndef __PMC_STABILITY_H
+#define __PMC_STABILITY_H
+
+#include <map>
+#include <vector>
+#include <cstdint>
+#include "msg.h"
+
+/**
+ * @brief Stability at an observation interval
+ */
+struct StabilityPoint {
+    double tau; /**< observation interval in seconds */
+    double adev; /**< Allan deviation */
+    double tdev; /**< time deviation in nanoseconds */
+    double mtie; /**< maximum time interval error in nanoseconds */
+    uint64_t terms; /**< number of terms in the estimates */
+};
+
+/**
+ * @brief Incremental stability statistics of a clock
+ * @details
+ *  Time error samples are taken at a fixed interval.
+ *  Observation intervals are the sample interval times powers of 2.
+ *  Samples are combined into blocks of 2 blocks of the previous
+ *  interval, each interval keeps only the blocks its statistics use,
+ *  so a sample costs O(1) amortised and memory is fixed.
+ *  Allan deviation uses the phase at the start of each block and
+ *  time deviation uses the average phase of each block.
+ *  MTIE is estimated from windows starting at each block.
+ */
+class ClockStability
+{
+  private:
+    struct Block {
+        double sum; /* Sum of time errors */
+        int64_t min;
+        int64_t max;
+        int64_t first; /* First time error */
+    };
+    struct Level {
+        Block pending; /* First block of the next level block */
+        Block last; /* Previous block */
+        bool hasPending;
+        uint64_t blocks;
+        int64_t x1, x2; /* Previous phases */
+        double m1, m2; /* Previous average phases */
+        double sumAdev;
+        double sumTdev;
+        uint64_t terms;
+        int64_t mtie;
+    };
+    double m_tau0;
+    uint64_t m_samples;
+    std::vector<Level> m_levels;
+    void add(size_t level, const Block &block);
+
+  public:
+    /**
+     * Constructor
+     * @param[in] tau0 sample interval in seconds
+     * @param[in] levels number of observation intervals
+     */
+    ClockStability(double tau0 = 1, size_t levels = 16);
+    /**
+     * Add a sample
+     * @param[in] offset time error in nanoseconds
+     */
+    void add(int64_t offset);
+    /**
+     * Remove all samples
+     */
+    void reset();
+    /**
+     * Get sample interval
+     * @return interval in seconds
+     */
+    double getTau0() const { return m_tau0; }
+    /**
+     * Get number of samples
+     * @return number of samples
+     */
+    uint64_t getSamples() const { return m_samples; }
+    /**
+     * Get number of observation intervals
+     * @return number of intervals
+     */
+    size_t getLevels() const { return m_levels.size(); }
+    /**
+     * Get statistics of an observation interval
+     * @param[in] level of interval, the sample interval times 2 ^ level
+     * @return statistics, with zero terms if not enough samples
+     */
+    StabilityPoint getPoint(size_t level) const;
+    /**
+     * Get statistics of all observation intervals with samples
+     * @return statistics by observation interval
+     */
+    std::vector<StabilityPoint> getPoints() const;
+};
+
+/**
+ * @brief Stability statistics of clocks
+ * @details
+ *  Keep stability statistics of each clock, fed from
+ *  TIME_STATUS_NP master_offset of polled replies or from
+ *  SLAVE_RX_SYNC_TIMING_DATA records of signaling messages.
+ *  Once a clock sends synchronization timing data, its statistics
+ *  restart using the synchronization interval and its polled offsets
+ *  are ignored.
+ * @note the monitor is not thread safe.
+ */
+class StabilityMonitor
+{
+  private:
+    struct Clock {
+        ClockStability stability;
+        bool sync; /* Use synchronization timing data */
+    };
+    double m_pollInterval;
+    double m_syncInterval;
+    size_t m_levels;
+    std::map<uint64_t, Clock> m_clocks;
+    Clock &node(const ClockIdentity_t &clock, bool sync);
+
+  public:
+    /**
+     * Constructor
+     * @param[in] pollInterval interval of polled offsets in seconds
+     * @param[in] levels number of observation intervals
+     */
+    StabilityMonitor(double pollInterval = 1, size_t levels = 16);
+    /**
+     * Set synchronization interval
+     * @param[in] interval of synchronization messages in seconds
+     * @return true if interval is valid
+     * @note apply to clocks with new synchronization timing data
+     */
+    bool setSyncInterval(double interval);
+    /**
+     * Feed samples from a parsed message
+     * @param[in] msg parsed reply, notification or signaling message
+     * @return number of samples added
+     */
+    size_t feed(const Message &msg);
+    /**
+     * Feed a sample from management TLV data
+     * @param[in] peer port that sent the data
+     * @param[in] id management ID
+     * @param[in] data management TLV data
+     * @return number of samples added
+     */
+    size_t feed(const PortIdentity_t &peer, mng_vals_e id,
+        const BaseMngTlv *data);
+    /**
+     * Feed samples from synchronization timing data
+     * @param[in] peer port that sent the data
+     * @param[in] data synchronization timing data
+     * @return number of samples added
+     */
+    size_t feed(const PortIdentity_t &peer,
+        const SLAVE_RX_SYNC_TIMING_DATA_t &data);
+    /**
+     * Get statistics of a clock
+     * @param[in] clock ID
+     * @return statistics or null if clock has no samples
+     */
+    const ClockStability *get(const ClockIdentity_t &clock) const;
+    /**
+     * Remove statistics of a clock
+     * @param[in] clock ID
+     * @return true if clock was removed
+     */
+    bool remove(const ClockIdentity_t &clock);
+    /**
+     * Get number of clocks
+     * @return number of clocks
+     */
+    size_t size() const { return m_clocks.size(); }
+};
+
+#endif /*__PMC_STABILITY_H*/
@@ -0,0 +1,132 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+
+/** @file
+ * @brief Hierarchical timer wheel
+ *
+ * @author Erez Geva <ErezGeva2@@gmail.com>
+ * @copyright 2021 Erez Geva
+ *
+ */
+
+#include "timer.h"
+
+TimerWheel::TimerWheel(uint64_t now_ms) : m_now(now_ms), m_count(0)
+{
+    for(uint32_t &head : m_slots)
+        head = nil;
+}
+void TimerWheel::link(uint32_t idx)
+{
+    Node &n = m_nodes[idx];
+    uint64_t expire = n.expire;
+    uint64_t max = m_now + (1ULL << (lvl_bits * levels)) - 1;
+    if(expire > max)
+        expire = max; // Moved down when reaching the last level end
+    uint64_t delta = expire - m_now;
+    uint32_t lvl = 0;
+    while(lvl < levels - 1 && delta >= (1ULL << (lvl_bits * (lvl + 1))))
+        lvl++;
+    uint32_t slot = lvl * lvl_slots +
+        ((expire >> (lvl_bits * lvl)) & lvl_mask);
+    n.slot = slot;
+    n.prev = nil;
+    n.next = m_slots[slot];
+    if(n.next != nil)
+        m_nodes[n.next].prev = idx;
+    m_slots[slot] = idx;
+}
+void TimerWheel::unlink(uint32_t idx)
+{
+    Node &n = m_nodes[idx];
+    if(n.prev != nil)
+        m_nodes[n.prev].next = n.next;
+    else
+        m_slots[n.slot] = n.next;
+    if(n.next != nil)
+        m_nodes[n.next].prev = n.prev;
+}
+TimerWheel::Handle TimerWheel::add(uint64_t expire_ms, uint64_t cookie)
+{
+    uint32_t idx;
+    if(m_free.empty()) {
+        idx = m_nodes.size();
+        m_nodes.push_back({0});
+    } else {
+        idx = m_free.back();
+        m_free.pop_back();
+    }
+    Node &n = m_nodes[idx];
+    // Current tick was already processed
+    n.expire = expire_ms > m_now ? expire_ms : m_now + 1;
+    n.cookie = cookie;
+    link(idx);
+    m_count++;
+    return ((Handle)n.gen << 32) | idx;
+}
+bool TimerWheel::cancel(Handle handle)
+{
+    uint32_t idx = handle & UINT32_MAX;
+    if(idx >= m_nodes.size())
+        return false;
+    Node &n = m_nodes[idx];
+    if(n.slot == nil || n.gen != handle >> 32)
+        return false;
+    unlink(idx);
+    n.slot = nil;
+    n.gen++;
+    m_free.push_back(idx);
+    m_count--;
+    return true;
+}
+size_t TimerWheel::advance(uint64_t now_ms, const Expired &expired)
+{
+    size_t fired = 0;
+    while(m_now < now_ms) {
+        if(m_count == 0) {
+            m_now = now_ms;
+            break;
+        }
+        m_now++;
+        // Move timers down from upper levels when lower level wraps
+        for(uint32_t lvl = 1; lvl < levels; lvl++) {
+            if(((m_now >> (lvl_bits * (lvl - 1))) & lvl_mask) != 0)
+                break;
+            uint32_t slot = lvl * lvl_slots +
+                ((m_now >> (lvl_bits * lvl)) & lvl_mask);
+            uint32_t idx = m_slots[slot];
+            m_slots[slot] = nil;
+            while(idx != nil) {
+                uint32_t next = m_nodes[idx].next;
+                link(idx);
+                idx = next;
+            }
+        }
+        uint32_t slot = m_now & lvl_mask;
+        while(m_slots[slot] != nil) {
+            uint32_t idx = m_slots[slot];
+            Node &n = m_nodes[idx];
+            uint64_t cookie = n.cookie;
+            unlink(idx);
+            n.slot = nil;
+            n.gen++;
+            m_free.push_back(idx);
+            m_count--;
+            fired++;
+            // Callback may add timers to the slot
+            expired(cookie);
+        }
+    }
+    return fired;
+}
+int64_t TimerWheel::nextTimeout() const
+{
+    if(m_count == 0)
+        return -1;
+    uint64_t left = lvl_slots - (m_now & lvl_mask);
+    for(uint64_t i = 1; i < left; i++) {
+        if(m_slots[(m_now + i) & lvl_mask] != nil)
+            return i;
+    }
+    // Next move down of upper level
+    return left;
+}
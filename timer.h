@@ -0,0 +1,127 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+
+/** @file
+ * @brief Hierarchical timer wheel
+ *
+ * @author Erez Geva <ErezGeva2@@gmail.com>
+ * @copyright 2021 Erez Geva
+ *
+ */
+
+#ifndef __PMC_TIMER_H
+#define __PMC_TIMER_H
+
+#include <ctime>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <functional>
+
+/**
+ * Get monotonic time in microseconds
+ * @return time in microseconds
+ */
+inline uint64_t nowUs()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+/**
+ * Get monotonic time in milliseconds
+ * @return time in milliseconds
+ * @note use as current time of a timer wheel
+ */
+inline uint64_t nowMs() { return nowUs() / 1000; }
+
+/**
+ * @brief Hierarchical timer wheel with millisecond resolution
+ * @details
+ *  Hold timers of outstanding requests and periodic polling.
+ *  Adding and canceling a timer take constant time.
+ *  Timers are kept in 4 levels of 64 slots,
+ *  timers up to 4.6 hours are placed directly,
+ *  longer timers are moved down when reaching the last level end.
+ * @note the wheel is not thread safe.
+ */
+class TimerWheel
+{
+  private:
+    static const uint32_t lvl_bits = 6;
+    static const uint32_t lvl_slots = 1 << lvl_bits;
+    static const uint32_t lvl_mask = lvl_slots - 1;
+    static const uint32_t levels = 4;
+    static const uint32_t nil = UINT32_MAX;
+    struct Node {
+        uint64_t expire; /* in milliseconds */
+        uint64_t cookie;
+        uint32_t prev;
+        uint32_t next;
+        uint32_t slot; /* nil when free */
+        uint32_t gen; /* Generation, detect stale handle */
+    };
+    std::vector<Node> m_nodes;
+    std::vector<uint32_t> m_free;
+    uint32_t m_slots[levels * lvl_slots]; /* List head of each slot */
+    uint64_t m_now; /* Current tick */
+    size_t m_count;
+    void link(uint32_t idx);
+    void unlink(uint32_t idx);
+
+  public:
+    /**
+     * Handle of timer
+     */
+    typedef uint64_t Handle;
+    /**
+     * Expire callback
+     * @param[in] cookie of expired timer
+     */
+    typedef std::function<void (uint64_t cookie)> Expired;
+    /**
+     * Constructor
+     * @param[in] now_ms current time in milliseconds
+     */
+    TimerWheel(uint64_t now_ms = 0);
+    /**
+     * Add a timer
+     * @param[in] expire_ms expire time in milliseconds
+     * @param[in] cookie returned to expire callback
+     * @return timer handle
+     * @note timer that already expired fires on next advance
+     */
+    Handle add(uint64_t expire_ms, uint64_t cookie);
+    /**
+     * Cancel a timer
+     * @param[in] handle timer handle
+     * @return true if timer was pending
+     */
+    bool cancel(Handle handle);
+    /**
+     * Advance wheel time and fire expired timers
+     * @param[in] now_ms current time in milliseconds
+     * @param[in] expired callback called for each expired timer
+     * @return number of timers fired
+     * @note the callback may add and cancel timers
+     */
+    size_t advance(uint64_t now_ms, const Expired &expired);
+    /**
+     * Get time until wheel should be advanced
+     * @return milliseconds or negative if wheel is empty
+     * @note the time may be shorter than the nearest timer,
+     *  when timers need to move between levels.
+     */
+    int64_t nextTimeout() const;
+    /**
+     * Get number of pending timers
+     * @return number of timers
+     */
+    size_t size() const { return m_count; }
+    /**
+     * Get current wheel time
+     * @return time in milliseconds
+     */
+    uint64_t now() const { return m_now; }
+};
+
+#endif /*__PMC_TIMER_H*/
@@ -0,0 +1,221 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+
+/** @file
+ * @brief PTP topology discovery
+ *
+ * @author Erez Geva <ErezGeva2@@gmail.com>
+ * @copyright 2021 Erez Geva
+ *
+ */
+
+#include <cstring>
+#include "topo.h"
+
+static inline bool sameClock(const ClockIdentity_t &a, const ClockIdentity_t &b)
+{
+    return memcmp(a.v, b.v, a.size()) == 0;
+}
+/* Bit of data in round */
+static inline uint8_t dataBit(mng_vals_e id)
+{
+    switch(id) {
+        case DEFAULT_DATA_SET:
+            return 1 << 0;
+        case PARENT_DATA_SET:
+            return 1 << 1;
+        case PORT_DATA_SET:
+            return 1 << 2;
+        case PATH_TRACE_LIST:
+            return 1 << 3;
+        default:
+            return 0;
+    }
+}
+bool TopoClock::isGrandmaster() const
+{
+    return hasParent && sameClock(parent.clockIdentity, identity);
+}
+bool Topology::ClockLess::operator()(const ClockIdentity_t &a,
+    const ClockIdentity_t &b) const
+{
+    return memcmp(a.v, b.v, a.size()) < 0;
+}
+Topology::Topology(TransEngine &engine) :
+    m_engine(engine),
+    m_outstanding(0),
+    m_stats{0}
+{
+}
+TopoClock &Topology::node(const ClockIdentity_t &identity)
+{
+    auto it = m_clocks.find(identity);
+    if(it != m_clocks.end())
+        return it->second;
+    TopoClock &clock = m_clocks[identity];
+    clock.identity = identity;
+    clock.hasDefault = false;
+    clock.hasParent = false;
+    clock.hasPorts = false;
+    clock.hasPathTrace = false;
+    clock.updated = 0;
+    return clock;
+}
+bool Topology::discover()
+{
+    if(m_outstanding > 0)
+        return false;
+    m_round.clear();
+    PortIdentity_t all;
+    memset(all.clockIdentity.v, 0xff, all.clockIdentity.size());
+    all.portNumber = UINT16_MAX;
+    for(mng_vals_e id : {DEFAULT_DATA_SET, PARENT_DATA_SET, PORT_DATA_SET,
+                PATH_TRACE_LIST
+            })
+        query(all, id, true);
+    if(m_outstanding == 0)
+        return false;
+    m_stats.rounds++;
+    return true;
+}
+void Topology::query(const PortIdentity_t &target, mng_vals_e id, bool all)
+{
+    int ret = m_engine.request(target, GET, id,
+    [this, all](const TransReply & reply) { this->reply(reply, all); });
+    if(ret < 0)
+        return;
+    m_outstanding++;
+    if(!all)
+        m_stats.followUps++;
+}
+void Topology::reply(const TransReply &reply, bool all)
+{
+    if(reply.msg != nullptr) {
+        // Error replies count, clock may not support the ID
+        m_round[reply.msg->getPeer().clockIdentity] |= dataBit(reply.id);
+        if(reply.status == TRANS_OK && reply.data != nullptr)
+            update(reply);
+    }
+    if(!reply.last)
+        return;
+    m_outstanding--;
+    if(all)
+        followUp(reply.id);
+}
+void Topology::followUp(mng_vals_e id)
+{
+    uint8_t bit = dataBit(id);
+    for(const auto &it : m_clocks) {
+        auto round = m_round.find(it.first);
+        if(round != m_round.end() && (round->second & bit))
+            continue;
+        PortIdentity_t target;
+        target.clockIdentity = it.first;
+        // Clock data is replied by any port
+        target.portNumber = id == PORT_DATA_SET ? UINT16_MAX : 0;
+        query(target, id, false);
+    }
+}
+void Topology::update(const TransReply &reply)
+{
+    const PortIdentity_t &peer = reply.msg->getPeer();
+    TopoClock &clock = node(peer.clockIdentity);
+    clock.updated = nowMs();
+    bool changed = false;
+    switch(reply.id) {
+        case DEFAULT_DATA_SET: {
+            const DEFAULT_DATA_SET_t &d =
+                *static_cast<const DEFAULT_DATA_SET_t *>(reply.data);
+            changed = !clock.hasDefault ||
+                clock.numberPorts != d.numberPorts ||
+                clock.priority1 != d.priority1 ||
+                clock.priority2 != d.priority2 ||
+                clock.clockQuality.clockClass != d.clockQuality.clockClass ||
+                clock.clockQuality.clockAccuracy !=
+                d.clockQuality.clockAccuracy ||
+                clock.clockQuality.offsetScaledLogVariance !=
+                d.clockQuality.offsetScaledLogVariance ||
+                clock.domainNumber != d.domainNumber;
+            clock.numberPorts = d.numberPorts;
+            clock.priority1 = d.priority1;
+            clock.priority2 = d.priority2;
+            clock.clockQuality = d.clockQuality;
+            clock.domainNumber = d.domainNumber;
+            clock.hasDefault = true;
+            break;
+        }
+        case PARENT_DATA_SET: {
+            const PARENT_DATA_SET_t &d =
+                *static_cast<const PARENT_DATA_SET_t *>(reply.data);
+            changed = !clock.hasParent ||
+                !sameClock(clock.parent.clockIdentity,
+                    d.parentPortIdentity.clockIdentity) ||
+                clock.parent.portNumber != d.parentPortIdentity.portNumber ||
+                !sameClock(clock.grandmaster, d.grandmasterIdentity);
+            clock.parent = d.parentPortIdentity;
+            clock.grandmaster = d.grandmasterIdentity;
+            clock.hasParent = true;
+            // Parent is queried directly if not seen
+            node(d.parentPortIdentity.clockIdentity);
+            break;
+        }
+        case PORT_DATA_SET: {
+            const PORT_DATA_SET_t &d =
+                *static_cast<const PORT_DATA_SET_t *>(reply.data);
+            auto it = clock.ports.find(d.portIdentity.portNumber);
+            changed = it == clock.ports.end() || it->second != d.portState;
+            clock.ports[d.portIdentity.portNumber] = d.portState;
+            clock.hasPorts = true;
+            break;
+        }
+        case PATH_TRACE_LIST: {
+            const PATH_TRACE_LIST_t &d =
+                *static_cast<const PATH_TRACE_LIST_t *>(reply.data);
+            changed = !clock.hasPathTrace ||
+                clock.pathTrace.size() != d.pathSequence.size();
+            for(size_t i = 0; !changed && i < d.pathSequence.size(); i++)
+                changed = !sameClock(clock.pathTrace[i], d.pathSequence[i]);
+            clock.pathTrace = d.pathSequence;
+            clock.hasPathTrace = true;
+            break;
+        }
+        default:
+            return;
+    }
+    if(changed) {
+        m_stats.changes++;
+        if(m_changed)
+            m_changed(clock, reply.id);
+    }
+}
+const TopoClock *Topology::getClock(const ClockIdentity_t &identity) const
+{
+    auto it = m_clocks.find(identity);
+    if(it == m_clocks.end())
+        return nullptr;
+    return &it->second;
+}
+std::vector<ClockIdentity_t> Topology::getChildren(
+    const ClockIdentity_t &identity) const
+{
+    std::vector<ClockIdentity_t> children;
+    for(const auto &it : m_clocks) {
+        const TopoClock &clock = it.second;
+        if(clock.hasParent && !clock.isGrandmaster() &&
+            sameClock(clock.parent.clockIdentity, identity))
+            children.push_back(clock.identity);
+    }
+    return children;
+}
+size_t Topology::expire(uint64_t age_ms)
+{
+    size_t count = 0;
+    uint64_t now = nowMs();
+    for(auto it = m_clocks.begin(); it != m_clocks.end();) {
+        if(it->second.updated + age_ms <= now) {
+            it = m_clocks.erase(it);
+            count++;
+        } else
+            ++it;
+    }
+    return count;
+}
@@ -0,0 +1,169 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+
+/** @file
+ * @brief PTP topology discovery
+ *
+ * @author Erez Geva <ErezGeva2@@gmail.com>
+ * @copyright 2021 Erez Geva
+ *
+ */
+
+#ifndef __PMC_TOPO_H
+#define __PMC_TOPO_H
+
+#include <map>
+#include <vector>
+#include <cstdint>
+#include "trans.h"
+
+/**
+ * @brief Clock in the topology
+ */
+struct TopoClock {
+    ClockIdentity_t identity; /**< clock ID */
+    /* From DEFAULT_DATA_SET */
+    UInteger16_t numberPorts; /**< number of ports */
+    UInteger8_t priority1; /**< priority 1 */
+    UInteger8_t priority2; /**< priority 2 */
+    ClockQuality_t clockQuality; /**< clock quality */
+    UInteger8_t domainNumber; /**< domain number */
+    /* From PARENT_DATA_SET */
+    PortIdentity_t parent; /**< parent port, own port on grand source */
+    ClockIdentity_t grandmaster; /**< grand source clock ID */
+    /* From PORT_DATA_SET */
+    std::map<uint16_t, portState_e> ports; /**< state of each port */
+    /* From PATH_TRACE_LIST */
+    std::vector<ClockIdentity_t> pathTrace; /**< clocks to grand source */
+    bool hasDefault; /**< DEFAULT_DATA_SET received */
+    bool hasParent; /**< PARENT_DATA_SET received */
+    bool hasPorts; /**< PORT_DATA_SET received */
+    bool hasPathTrace; /**< PATH_TRACE_LIST received */
+    uint64_t updated; /**< time of last reply in milliseconds */
+    /**
+     * Is clock a grand source
+     * @return true if clock parent is the clock itself
+     */
+    bool isGrandmaster() const;
+};
+
+/**
+ * Topology change callback
+ * @param[in] clock that changed
+ * @param[in] id management ID of the changed data
+ */
+typedef std::function<void (const TopoClock &clock, mng_vals_e id)>
+TopoCallback;
+
+/**
+ * @brief Topology statistics
+ */
+struct TopoStats {
+    uint64_t rounds; /**< discovery rounds */
+    uint64_t followUps; /**< requests to a single clock */
+    uint64_t changes; /**< clock changes */
+};
+
+/**
+ * @brief PTP topology discovery
+ * @details
+ *  Query all clocks for DEFAULT_DATA_SET, PARENT_DATA_SET,
+ *  PORT_DATA_SET and PATH_TRACE_LIST concurrently.
+ *  Clocks that did not reply to a query of all clocks and parents
+ *  that were not seen are queried directly when the query ends.
+ *  The graph is kept between discovery rounds and is updated with
+ *  each reply, changes are reported to the change callback.
+ * @note the topology is not thread safe, use it from the engine thread.
+ */
+class Topology
+{
+  public:
+    /**
+     * @brief Order of clock IDs
+     */
+    struct ClockLess {
+        /**
+         * Compare clock IDs
+         * @param[in] a clock ID
+         * @param[in] b clock ID
+         * @return true if a is before b
+         */
+        bool operator()(const ClockIdentity_t &a,
+            const ClockIdentity_t &b) const;
+    };
+
+  private:
+    TransEngine &m_engine;
+    std::map<ClockIdentity_t, TopoClock, ClockLess> m_clocks;
+    /* Data received from each clock in current round */
+    std::map<ClockIdentity_t, uint8_t, ClockLess> m_round;
+    size_t m_outstanding; /* Requests of current round */
+    TopoCallback m_changed;
+    TopoStats m_stats;
+    TopoClock &node(const ClockIdentity_t &identity);
+    void query(const PortIdentity_t &target, mng_vals_e id, bool all);
+    void reply(const TransReply &reply, bool all);
+    void followUp(mng_vals_e id);
+    void update(const TransReply &reply);
+
+  public:
+    /**
+     * Constructor
+     * @param[in] engine used to send requests and receive replies
+     */
+    Topology(TransEngine &engine);
+    /**
+     * Start a discovery round
+     * @return true if queries are sent
+     * @note a round ends when all its queries complete
+     */
+    bool discover();
+    /**
+     * Is discovery round running
+     * @return true if queries are pending
+     */
+    bool isRunning() const { return m_outstanding > 0; }
+    /**
+     * Process until discovery round ends
+     */
+    void run() {
+        while(m_outstanding > 0)
+            m_engine.process();
+    }
+    /**
+     * Set change callback
+     * @param[in] callback called when clock data is added or changed
+     */
+    void onChange(TopoCallback callback) { m_changed = callback; }
+    /**
+     * Get all clocks
+     * @return clocks by clock ID
+     */
+    const std::map<ClockIdentity_t, TopoClock, ClockLess> &getClocks() const
+    { return m_clocks; }
+    /**
+     * Get a clock
+     * @param[in] identity clock ID
+     * @return clock or null if not known
+     */
+    const TopoClock *getClock(const ClockIdentity_t &identity) const;
+    /**
+     * Get clocks that synchronize to a clock
+     * @param[in] identity clock ID
+     * @return clocks that use the clock as their parent
+     */
+    std::vector<ClockIdentity_t> getChildren(const ClockIdentity_t &identity)
+    const;
+    /**
+     * Remove clocks without replies
+     * @param[in] age_ms remove clocks without reply in this time
+     * @return number of clocks removed
+     */
+    size_t expire(uint64_t age_ms);
+    /**
+     * Get statistics
+     * @return statistics
+     */
+    const TopoStats &getStats() const { return m_stats; }
+};
+
+#endif /*__PMC_TOPO_H*/
@@ -0,0 +1,734 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+
+/** @file
+ * @brief Asynchronous management requests
+ *
+ * @author Erez Geva <ErezGeva2@@gmail.com>
+ * @copyright 2021 Erez Geva
+ *
+ */
+
+#include <cstring>
+#include <algorithm>
+#include "end.h"
+#include "trans.h"
+
+const size_t trans_buf_size = 2000;
+const size_t ptp_domain_offset = 4;
+const size_t ptp_source_offset = 20; // sourcePortIdentity
+const size_t ptp_sequence_offset = 30;
+const size_t ptp_target_offset = 34; // targetPortIdentity in management
+const uint32_t nil = UINT32_MAX;
+const TimerWheel::Handle no_timer = UINT64_MAX;
+const uint32_t table_min_bits = 6;
+
+static inline uint64_t clockKey(const ClockIdentity_t &clock)
+{
+    uint64_t key;
+    memcpy(&key, clock.v, sizeof(key));
+    return key;
+}
+static inline bool allOnes(const ClockIdentity_t &clock)
+{
+    for(size_t i = 0; i < clock.size(); i++) {
+        if(clock.v[i] != 0xff)
+            return false;
+    }
+    return true;
+}
+static inline bool isMulti(const PortIdentity_t &target)
+{
+    return allOnes(target.clockIdentity) || target.portNumber == UINT16_MAX;
+}
+TransEngine::FlightKey TransEngine::flightKey(const PortIdentity_t &target,
+    mng_vals_e id) const
+{
+    const MsgParams &prms = m_msg.getParams();
+    return FlightKey(clockKey(target.clockIdentity),
+            (uint64_t)target.portNumber << 32 | (uint64_t)id << 16 |
+            prms.domainNumber << 8 | prms.transportSpecific);
+}
+bool TransEngine::hasWaiters(const Request &req) const
+{
+    for(uint16_t sequence : req.waiters) {
+        uint32_t i = find(sequence);
+        if(i != nil && m_reqs[m_table[i]].follower &&
+            m_reqs[m_table[i]].leaderSeq == req.sequence)
+            return true;
+    }
+    return false;
+}
+TransEngine::TransEngine(SockBase &sock, Message &msg) :
+    m_sock(sock),
+    m_msg(msg),
+    m_rcvMsg(msg.getParams()),
+    m_sendBuf(trans_buf_size),
+    m_rcvBuf(trans_buf_size),
+    m_wheel(nowMs()),
+    m_table(1 << table_min_bits, nil),
+    m_tableBits(table_min_bits),
+    m_pending(0),
+    m_sequence(0),
+    m_timeout(500),
+    m_minRto(10),
+    m_maxRto(4000),
+    m_maxRetries(2),
+    m_cache(nullptr),
+    m_singleFlight(true),
+    m_limitPolicy(TRANS_LIMIT_QUEUE),
+    m_completed(0),
+    m_batching(false),
+    m_stats{0}
+{
+}
+TransEngine::~TransEngine()
+{
+    for(uint32_t idx = 0; idx < m_reqs.size(); idx++) {
+        if(m_reqs[idx].used)
+            complete(idx, TRANS_CANCEL, nullptr);
+    }
+}
+bool TransEngine::setTimeout(uint64_t timeout_ms)
+{
+    if(timeout_ms == 0)
+        return false;
+    m_timeout = timeout_ms;
+    return true;
+}
+bool TransEngine::setRtoLimits(uint64_t min_ms, uint64_t max_ms)
+{
+    if(min_ms == 0 || min_ms > max_ms)
+        return false;
+    m_minRto = min_ms;
+    m_maxRto = max_ms;
+    return true;
+}
+bool TransEngine::setTargetLimit(uint64_t rate, uint64_t burst)
+{
+    if(!m_targetLimit.set(rate, burst))
+        return false;
+    m_targets.clear();
+    return true;
+}
+bool TransEngine::setDomainLimit(uint64_t rate, uint64_t burst)
+{
+    if(!m_domainLimit.set(rate, burst))
+        return false;
+    m_domains.clear();
+    return true;
+}
+bool TransEngine::isLimited() const
+{
+    return m_targetLimit.isLimited() || m_domainLimit.isLimited() ||
+        m_sock.getRateLimit() > 0;
+}
+bool TransEngine::allow(const PortIdentity_t &target, uint8_t domain,
+    uint64_t now)
+{
+    TokenBucket *t = nullptr;
+    TokenBucket *d = nullptr;
+    if(m_targetLimit.isLimited()) {
+        auto key = std::make_pair(clockKey(target.clockIdentity),
+                target.portNumber);
+        auto it = m_targets.find(key);
+        if(it == m_targets.end())
+            it = m_targets.emplace(key, m_targetLimit).first;
+        t = &it->second;
+        if(t->wait(now) > 0)
+            return false;
+    }
+    if(m_domainLimit.isLimited()) {
+        auto it = m_domains.find(domain);
+        if(it == m_domains.end())
+            it = m_domains.emplace(domain, m_domainLimit).first;
+        d = &it->second;
+        if(d->wait(now) > 0)
+            return false;
+    }
+    // Take the socket token here, so the deadline starts when
+    // the request is sent and batches are not cut by the socket
+    if(!m_sock.reserveRate())
+        return false;
+    // Take tokens only when all limits allow
+    if(t != nullptr)
+        t->take(now);
+    if(d != nullptr)
+        d->take(now);
+    return true;
+}
+bool TransEngine::getRtt(const ClockIdentity_t &clock, TransRtt &rtt) const
+{
+    auto it = m_rtt.find(clockKey(clock));
+    if(it == m_rtt.end())
+        return false;
+    rtt = it->second;
+    return true;
+}
+uint64_t TransEngine::rto(const PortIdentity_t &target) const
+{
+    auto it = m_rtt.find(clockKey(target.clockIdentity));
+    if(it == m_rtt.end())
+        return m_timeout;
+    return it->second.rtoMs;
+}
+void TransEngine::sample(const PortIdentity_t &target, uint64_t rttUs)
+{
+    TransRtt &rtt = m_rtt[clockKey(target.clockIdentity)];
+    // RFC 6298 with clock granularity of 1 millisecond
+    if(rtt.samples == 0) {
+        rtt.srttUs = rttUs;
+        rtt.rttvarUs = rttUs / 2;
+    } else {
+        uint64_t diff = rtt.srttUs > rttUs ? rtt.srttUs - rttUs :
+            rttUs - rtt.srttUs;
+        rtt.rttvarUs = (3 * rtt.rttvarUs + diff) / 4;
+        rtt.srttUs = (7 * rtt.srttUs + rttUs) / 8;
+    }
+    rtt.samples++;
+    uint64_t var = 4 * rtt.rttvarUs;
+    if(var < 1000)
+        var = 1000;
+    uint64_t rto = (rtt.srttUs + var + 999) / 1000;
+    rtt.rtoMs = std::min(std::max(rto, m_minRto), m_maxRto);
+}
+uint32_t TransEngine::hash(uint16_t sequence) const
+{
+    // Fibonacci hashing
+    return (sequence * 0x9e3779b1U) >> (32 - m_tableBits);
+}
+uint32_t TransEngine::find(uint16_t sequence) const
+{
+    uint32_t mask = m_table.size() - 1;
+    for(uint32_t i = hash(sequence); m_table[i] != nil; i = (i + 1) & mask) {
+        if(m_reqs[m_table[i]].sequence == sequence)
+            return i;
+    }
+    return nil;
+}
+void TransEngine::insert(uint32_t idx)
+{
+    uint32_t mask = m_table.size() - 1;
+    uint32_t i = hash(m_reqs[idx].sequence);
+    while(m_table[i] != nil)
+        i = (i + 1) & mask;
+    m_table[i] = idx;
+}
+void TransEngine::erase(uint16_t sequence)
+{
+    uint32_t i = find(sequence);
+    if(i == nil)
+        return;
+    uint32_t mask = m_table.size() - 1;
+    // Backward shift deletion, keep probe sequences without holes
+    for(uint32_t j = (i + 1) & mask; m_table[j] != nil; j = (j + 1) & mask) {
+        uint32_t k = hash(m_reqs[m_table[j]].sequence);
+        // Move entry if its home slot is not between the hole and it
+        if(((j - k) & mask) >= ((j - i) & mask)) {
+            m_table[i] = m_table[j];
+            i = j;
+        }
+    }
+    m_table[i] = nil;
+}
+void TransEngine::grow()
+{
+    m_tableBits++;
+    m_table.assign(1 << m_tableBits, nil);
+    for(uint32_t idx = 0; idx < m_reqs.size(); idx++) {
+        if(m_reqs[idx].used)
+            insert(idx);
+    }
+}
+uint32_t TransEngine::alloc()
+{
+    uint32_t idx;
+    if(m_freeReqs.empty()) {
+        idx = m_reqs.size();
+        m_reqs.emplace_back();
+    } else {
+        idx = m_freeReqs.back();
+        m_freeReqs.pop_back();
+    }
+    m_reqs[idx].used = true;
+    m_pending++;
+    return idx;
+}
+void TransEngine::release(uint32_t idx)
+{
+    Request &req = m_reqs[idx];
+    erase(req.sequence);
+    m_wheel.cancel(req.timer);
+    req.callback = nullptr;
+    req.used = false;
+    m_freeReqs.push_back(idx);
+    m_pending--;
+}
+bool TransEngine::build(const PortIdentity_t *target, actionField_e action,
+    mng_vals_e id, BaseMngTlv *data)
+{
+    bool ret = data == nullptr ? m_msg.setAction(action, id) :
+        m_msg.setAction(action, id, *data);
+    if(!ret || m_msg.build(m_sendBuf, 0) != MNG_PARSE_ERROR_OK)
+        return false;
+    if(target != nullptr) {
+        uint8_t *buf = (uint8_t *)m_sendBuf.get() + ptp_target_offset;
+        memcpy(buf, target->clockIdentity.v, target->clockIdentity.size());
+        uint16_t port = cpu_to_net16(target->portNumber);
+        memcpy(buf + target->clockIdentity.size(), &port, sizeof(port));
+    }
+    return true;
+}
+int TransEngine::send(const PortIdentity_t *target, actionField_e action,
+    mng_vals_e id, BaseMngTlv *data, TransCallback callback)
+{
+    const PortIdentity_t &to = target != nullptr ? *target :
+        m_msg.getParams().target;
+    if(m_cache != nullptr) {
+        if(action != GET)
+            m_cache->invalidate(to.clockIdentity);
+        else if(!isMulti(to)) {
+            const std::vector<uint8_t> *frame = m_cache->find(to, id,
+                    m_msg.getParams().domainNumber);
+            if(frame != nullptr)
+                return hit(*frame, to, id, callback);
+        }
+    }
+    FlightKey key;
+    bool flight = m_singleFlight && action == GET && !isMulti(to);
+    if(flight) {
+        key = flightKey(to, id);
+        auto it = m_flights.find(key);
+        if(it != m_flights.end())
+            return follow(it->second, to, id, callback);
+    }
+    if(!build(target, action, id, data))
+        return -1;
+    int ret = post((uint8_t *)m_sendBuf.get(), m_msg.getMsgLen(), to,
+            action, id, callback, false);
+    if(ret >= 0 && flight) {
+        Request &req = m_reqs[m_table[find(ret)]];
+        req.leader = true;
+        req.flight = key;
+        m_flights[key] = ret;
+    }
+    return ret;
+}
+bool TransEngine::prepare(TransFrame &frame, const PortIdentity_t &target,
+    actionField_e action, mng_vals_e id)
+{
+    if(!build(&target, action, id, nullptr))
+        return false;
+    uint8_t *buf = (uint8_t *)m_sendBuf.get();
+    frame.frame.assign(buf, buf + m_msg.getMsgLen());
+    frame.target = target;
+    frame.id = id;
+    frame.action = action;
+    return true;
+}
+bool TransEngine::prepare(TransFrame &frame, const PortIdentity_t &target,
+    actionField_e action, mng_vals_e id, BaseMngTlv &data)
+{
+    if(!build(&target, action, id, &data))
+        return false;
+    uint8_t *buf = (uint8_t *)m_sendBuf.get();
+    frame.frame.assign(buf, buf + m_msg.getMsgLen());
+    frame.target = target;
+    frame.id = id;
+    frame.action = action;
+    return true;
+}
+int TransEngine::request(TransFrame &frame, TransCallback callback)
+{
+    if(frame.frame.size() <= ptp_sequence_offset + sizeof(uint16_t))
+        return -1;
+    return post(frame.frame.data(), frame.frame.size(), frame.target,
+            frame.action, frame.id, callback, m_batching);
+}
+uint32_t TransEngine::add(const PortIdentity_t &target,
+    actionField_e action, mng_vals_e id, TransCallback callback)
+{
+    if(m_pending >= UINT16_MAX || !callback)
+        return nil;
+    // Keep table at most half full
+    if((m_pending + 1) * 2 > m_table.size())
+        grow();
+    // Skip sequences still in flight
+    while(find(m_sequence) != nil)
+        m_sequence++;
+    uint32_t idx = alloc();
+    Request &req = m_reqs[idx];
+    req.callback = callback;
+    req.target = target;
+    req.timer = no_timer;
+    req.sequence = m_sequence++;
+    req.id = id;
+    req.action = action;
+    req.multi = isMulti(target);
+    req.cached = false;
+    req.leader = false;
+    req.follower = false;
+    req.deferred = false;
+    req.replies = 0;
+    req.retries = 0;
+    req.rtoMs = 0;
+    req.sentUs = nowUs();
+    req.frame.clear();
+    req.waiters.clear();
+    insert(idx);
+    return idx;
+}
+int TransEngine::hit(const std::vector<uint8_t> &frame,
+    const PortIdentity_t &target, mng_vals_e id, TransCallback callback)
+{
+    uint32_t idx = add(target, GET, id, callback);
+    if(idx == nil)
+        return -1;
+    Request &req = m_reqs[idx];
+    req.cached = true;
+    req.frame = frame;
+    uint16_t seq = cpu_to_net16(req.sequence);
+    memcpy(req.frame.data() + ptp_sequence_offset, &seq, sizeof(seq));
+    // Reply on next process(), like a reply from the clock
+    m_hits.push_back(req.sequence);
+    return req.sequence;
+}
+int TransEngine::follow(uint16_t leader, const PortIdentity_t &target,
+    mng_vals_e id, TransCallback callback)
+{
+    uint32_t idx = add(target, GET, id, callback);
+    if(idx == nil)
+        return -1;
+    Request &req = m_reqs[idx];
+    req.follower = true;
+    req.leaderSeq = leader;
+    m_reqs[m_table[find(leader)]].waiters.push_back(req.sequence);
+    m_stats.coalesced++;
+    return req.sequence;
+}
+int TransEngine::post(uint8_t *buf, size_t len, const PortIdentity_t &target,
+    actionField_e action, mng_vals_e id, TransCallback callback, bool batch)
+{
+    uint32_t idx = add(target, action, id, callback);
+    if(idx == nil)
+        return -1;
+    Request &req = m_reqs[idx];
+    uint16_t seq = cpu_to_net16(req.sequence);
+    memcpy(buf + ptp_sequence_offset, &seq, sizeof(seq));
+    // Replies target our port, prepared requests may change the domain
+    memcpy(req.self.clockIdentity.v, buf + ptp_source_offset,
+        req.self.clockIdentity.size());
+    uint16_t port;
+    memcpy(&port, buf + ptp_source_offset + req.self.clockIdentity.size(),
+        sizeof(port));
+    req.self.portNumber = net_to_cpu16(port);
+    req.domain = buf[ptp_domain_offset];
+    // Keep the order of delayed requests, process() sends them
+    if(isLimited() && (!m_deferred.empty() ||
+            !allow(target, buf[ptp_domain_offset], nowUs()))) {
+        m_stats.throttled++;
+        if(m_limitPolicy == TRANS_LIMIT_REJECT) {
+            release(idx);
+            return -1;
+        }
+        req.frame.assign(buf, buf + len);
+        req.deferred = true;
+        m_deferred.push_back(req.sequence);
+        return req.sequence;
+    }
+    if(!batch) {
+        if(!m_sock.send(buf, len)) {
+            m_stats.sendErrors++;
+            release(idx);
+            return -1;
+        }
+        m_stats.sent++;
+    }
+    arm(idx, buf, len);
+    if(batch) {
+        m_batchMsgs.push_back(buf);
+        m_batchLens.push_back(len);
+        m_batchReqs.push_back(idx);
+    }
+    return req.sequence;
+}
+void TransEngine::arm(uint32_t idx, const uint8_t *buf, size_t len)
+{
+    Request &req = m_reqs[idx];
+    // Resent request keeps its back off
+    if(req.retries == 0)
+        req.rtoMs = req.multi ? m_timeout : rto(req.target);
+    // Only GET is idempotent
+    if(req.action == GET && !req.multi && m_maxRetries > 0) {
+        if(buf != req.frame.data())
+            req.frame.assign(buf, buf + len);
+    } else
+        req.frame.clear();
+    req.sentUs = nowUs();
+    req.timer = m_wheel.add(req.sentUs / 1000 + req.rtoMs, idx);
+}
+void TransEngine::sendDeferred()
+{
+    std::vector<uint16_t> list, failed;
+    list.swap(m_deferred);
+    uint64_t now = nowUs();
+    for(uint16_t sequence : list) {
+        uint32_t i = find(sequence);
+        // Request may be canceled
+        if(i == nil || !m_reqs[m_table[i]].deferred)
+            continue;
+        uint32_t idx = m_table[i];
+        Request &req = m_reqs[idx];
+        // A limited target does not delay requests to other targets
+        if(!allow(req.target, req.frame[ptp_domain_offset], now)) {
+            m_deferred.push_back(sequence);
+            continue;
+        }
+        req.deferred = false;
+        if(!m_sock.send(req.frame.data(), req.frame.size())) {
+            m_stats.sendErrors++;
+            failed.push_back(sequence);
+            continue;
+        }
+        // Resent requests are counted in retries
+        if(req.retries == 0)
+            m_stats.sent++;
+        arm(idx, req.frame.data(), req.frame.size());
+    }
+    // Callbacks may send new requests
+    for(uint16_t sequence : failed) {
+        uint32_t i = find(sequence);
+        if(i != nil)
+            complete(m_table[i], TRANS_SEND_ERROR, nullptr);
+    }
+}
+size_t TransEngine::sendBatch()
+{
+    m_batching = false;
+    size_t count = m_batchMsgs.size();
+    if(count == 0)
+        return 0;
+    size_t sent = m_sock.send(m_batchMsgs.data(), m_batchLens.data(), count);
+    m_stats.sent += sent;
+    m_stats.sendErrors += count - sent;
+    // Callbacks may start a new batch
+    std::vector<uint32_t> failed(m_batchReqs.begin() + sent,
+        m_batchReqs.end());
+    m_batchMsgs.clear();
+    m_batchLens.clear();
+    m_batchReqs.clear();
+    for(uint32_t idx : failed)
+        complete(idx, TRANS_SEND_ERROR, nullptr);
+    return sent;
+}
+void TransEngine::complete(uint32_t idx, TransStatus_e status,
+    const Message *msg)
+{
+    Request &req = m_reqs[idx];
+    // Callback may send new requests and reallocate the slab
+    PortIdentity_t target = req.target;
+    TransReply reply = {
+        .status = status,
+        .sequence = req.sequence,
+        .id = req.id,
+        .action = req.action,
+        .target = &target,
+        .msg = msg,
+        .data = msg != nullptr ? msg->getData() : nullptr,
+        .rttUs = msg != nullptr && req.retries == 0 ?
+        nowUs() - req.sentUs : 0,
+        .retries = req.retries,
+        .cached = req.cached,
+        .last = !req.multi || msg == nullptr
+    };
+    if(!reply.last) {
+        // Wait for more replies till the deadline
+        req.replies++;
+        m_completed++;
+        TransCallback callback = req.callback;
+        callback(reply);
+        return;
+    }
+    std::vector<uint16_t> waiters;
+    if(req.leader) {
+        if(status == TRANS_CANCEL && hasWaiters(req)) {
+            // Keep the exchange for the coalesced requests
+            TransCallback callback = std::move(req.callback);
+            req.callback = nullptr;
+            m_completed++;
+            callback(reply);
+            return;
+        }
+        waiters.swap(req.waiters);
+        auto it = m_flights.find(req.flight);
+        if(it != m_flights.end() && it->second == req.sequence)
+            m_flights.erase(it);
+    }
+    // A GET sent before may have stored the old value
+    if(m_cache != nullptr && req.action != GET)
+        m_cache->invalidate(target.clockIdentity);
+    uint16_t sequence = req.sequence;
+    TransCallback callback = std::move(req.callback);
+    release(idx);
+    // Leader that was canceled has no callback
+    if(callback) {
+        m_completed++;
+        callback(reply);
+    }
+    for(uint16_t seq : waiters) {
+        uint32_t i = find(seq);
+        // Coalesced request may be canceled
+        if(i != nil && m_reqs[m_table[i]].follower &&
+            m_reqs[m_table[i]].leaderSeq == sequence)
+            complete(m_table[i], status, msg);
+    }
+}
+void TransEngine::expire(uint64_t cookie)
+{
+    uint32_t idx = cookie;
+    Request &req = m_reqs[idx];
+    // Timer is released by the wheel
+    req.timer = no_timer;
+    if(!req.frame.empty() && req.retries < m_maxRetries) {
+        // Back off the request only, as many requests to the same
+        // clock may be in flight
+        req.rtoMs = std::min(req.rtoMs * 2, m_maxRto);
+        req.retries++;
+        m_stats.retries++;
+        // Many requests may time out together, resend within the limits
+        if(isLimited() && !allow(req.target, req.domain, nowUs())) {
+            m_stats.throttled++;
+            req.deferred = true;
+            m_deferred.push_back(req.sequence);
+            return;
+        }
+        if(m_sock.send(req.frame.data(), req.frame.size())) {
+            req.sentUs = nowUs();
+            req.timer = m_wheel.add(req.sentUs / 1000 + req.rtoMs, idx);
+            return;
+        }
+        m_stats.sendErrors++;
+    }
+    if(req.replies > 0)
+        complete(idx, TRANS_END, nullptr);
+    else {
+        m_stats.timeouts++;
+        complete(idx, TRANS_TIMEOUT, nullptr);
+    }
+}
+void TransEngine::unsolicited(MNG_PARSE_ERROR_e err)
+{
+    // Events notifications are responses without a request
+    if(!m_notify || err != MNG_PARSE_ERROR_OK ||
+        m_rcvMsg.getReplyAction() != RESPONSE) {
+        m_stats.stray++;
+        return;
+    }
+    m_stats.notifications++;
+    TransNotify notify = m_notify;
+    notify(m_rcvMsg);
+}
+void TransEngine::handle(ssize_t cnt)
+{
+    MNG_PARSE_ERROR_e err = m_rcvMsg.parse(m_rcvBuf, cnt);
+    if(err != MNG_PARSE_ERROR_OK && err != MNG_PARSE_ERROR_MSG)
+        return;
+    uint32_t i = find(m_rcvMsg.getSequence());
+    if(i == nil) {
+        unsolicited(err);
+        return;
+    }
+    uint32_t idx = m_table[i];
+    Request &req = m_reqs[idx];
+    const PortIdentity_t &peer = m_rcvMsg.getPeer();
+    const PortIdentity_t &self = m_rcvMsg.getTarget();
+    actionField_e action = req.action == COMMAND ? ACKNOWLEDGE : RESPONSE;
+    // Port zero and all ports accept any port of the clock
+    // Replies to other management clients may use the same sequence
+    if(m_rcvMsg.getTlvId() != req.id ||
+        m_rcvMsg.getReplyAction() != action ||
+        m_rcvMsg.getDomainNumber() != req.domain ||
+        (!allOnes(self.clockIdentity) &&
+            (memcmp(self.clockIdentity.v, req.self.clockIdentity.v,
+                    self.clockIdentity.size()) != 0 ||
+                (self.portNumber != UINT16_MAX &&
+                    self.portNumber != req.self.portNumber))) ||
+        (!allOnes(req.target.clockIdentity) &&
+            memcmp(peer.clockIdentity.v, req.target.clockIdentity.v,
+                peer.clockIdentity.size()) != 0) ||
+        (req.target.portNumber != 0 && req.target.portNumber != UINT16_MAX &&
+            peer.portNumber != req.target.portNumber)) {
+        unsolicited(err);
+        return;
+    }
+    // Reply to a resent request is ambiguous (Karn's algorithm)
+    if(req.retries == 0 && !req.multi)
+        sample(req.target, nowUs() - req.sentUs);
+    if(err == MNG_PARSE_ERROR_MSG) {
+        m_stats.errors++;
+        complete(idx, TRANS_ERROR, &m_rcvMsg);
+    } else {
+        m_stats.replies++;
+        if(m_cache != nullptr && req.action == GET && !req.multi)
+            m_cache->store(req.target, req.id, m_rcvMsg.getDomainNumber(),
+                m_rcvBuf.get(), cnt);
+        complete(idx, TRANS_OK, &m_rcvMsg);
+    }
+}
+bool TransEngine::cancel(uint16_t sequence)
+{
+    uint32_t i = find(sequence);
+    if(i == nil || !m_reqs[m_table[i]].callback)
+        return false;
+    complete(m_table[i], TRANS_CANCEL, nullptr);
+    return true;
+}
+size_t TransEngine::process(uint64_t timeout_ms)
+{
+    uint64_t end = timeout_ms > 0 ? nowMs() + timeout_ms : 0;
+    m_completed = 0;
+    if(!m_hits.empty()) {
+        // Callbacks may add cached replies
+        std::vector<uint16_t> hits;
+        hits.swap(m_hits);
+        for(uint16_t sequence : hits) {
+            uint32_t i = find(sequence);
+            // Request may be canceled
+            if(i == nil || !m_reqs[m_table[i]].cached)
+                continue;
+            uint32_t idx = m_table[i];
+            Request &req = m_reqs[idx];
+            if(m_rcvMsg.parse(req.frame.data(), req.frame.size()) ==
+                MNG_PARSE_ERROR_OK)
+                complete(idx, TRANS_OK, &m_rcvMsg);
+            else
+                complete(idx, TRANS_ERROR, nullptr);
+        }
+        if(m_completed > 0)
+            return m_completed;
+    }
+    // Receive notifications even without pending requests
+    while(m_pending > 0 || m_notify) {
+        if(!m_deferred.empty())
+            sendDeferred();
+        // Send messages queued by the socket rate limit
+        if(m_sock.getQueueDepth() > 0)
+            m_sock.flush();
+        ssize_t cnt;
+        while((cnt = m_sock.rcv(m_rcvBuf, false)) >= 0)
+            handle(cnt);
+        uint64_t now = nowMs();
+        m_wheel.advance(now, [this](uint64_t cookie) { expire(cookie); });
+        if(m_completed > 0 || (end > 0 && now >= end) ||
+            (m_pending == 0 && end == 0))
+            break;
+        // Wake for the next deadline
+        uint64_t wait = m_wheel.nextTimeout();
+        if(end > 0 && end - now < wait)
+            wait = end - now;
+        // Wake for the rate limits
+        if((!m_deferred.empty() || m_sock.getQueueDepth() > 0) && wait > 1)
+            wait = 1;
+        m_sock.poll(wait);
+    }
+    return m_completed;
+}
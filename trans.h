@@ -0,0 +1,468 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+
+/** @file
+ * @brief Asynchronous management requests
+ *
+ * @author Erez Geva <ErezGeva2@@gmail.com>
+ * @copyright 2021 Erez Geva
+ *
+ */
+
+#ifndef __PMC_TRANS_H
+#define __PMC_TRANS_H
+
+#include <map>
+#include <vector>
+#include <cstdint>
+#include <functional>
+#include "msg.h"
+#include "sock.h"
+#include "buf.h"
+#include "timer.h"
+#include "rate.h"
+#include "cache.h"
+
+/** Request completion status */
+enum TransStatus_e {
+    TRANS_OK,       /**< Reply received */
+    TRANS_ERROR,    /**< MANAGEMENT_ERROR_STATUS reply received */
+    TRANS_TIMEOUT,  /**< No reply before deadline */
+    TRANS_END,      /**< Deadline of request to multiple ports passed */
+    TRANS_CANCEL,   /**< Request is canceled */
+    TRANS_SEND_ERROR, /**< Batched or delayed request failed to send */
+};
+
+/** Handling of requests above the rate limits */
+enum TransLimit_e {
+    TRANS_LIMIT_QUEUE,  /**< Delay request till the limits allow */
+    TRANS_LIMIT_REJECT, /**< Request fails */
+};
+
+/**
+ * @brief Completion of a request
+ * @note parsed message and data are valid only during the callback
+ */
+struct TransReply {
+    TransStatus_e status; /**< completion status */
+    uint16_t sequence; /**< request sequence */
+    mng_vals_e id; /**< request management ID */
+    actionField_e action; /**< request action */
+    const PortIdentity_t *target; /**< request target */
+    /** parsed reply message, null if no reply */
+    const Message *msg;
+    /** reply management TLV data, null if none */
+    const BaseMngTlv *data;
+    /** round trip time in microseconds, zero if request was resent */
+    uint64_t rttUs;
+    uint32_t retries; /**< number of times the request was resent */
+    bool cached; /**< reply is from the cache */
+    bool last; /**< request is removed, no more callbacks */
+};
+
+/**
+ * Request completion callback
+ * @param[in] reply completion of request
+ */
+typedef std::function<void (const TransReply &reply)> TransCallback;
+
+/**
+ * Unsolicited message callback
+ * @param[in] msg parsed message, valid only during the callback
+ */
+typedef std::function<void (const Message &msg)> TransNotify;
+
+/**
+ * @brief Transaction engine statistics
+ */
+struct TransStats {
+    uint64_t sent; /**< requests sent */
+    uint64_t replies; /**< replies matched */
+    uint64_t errors; /**< management error status replies */
+    uint64_t timeouts; /**< requests without reply */
+    uint64_t stray; /**< replies that do not match a request */
+    /** responses that do not match a request, passed to notify callback */
+    uint64_t notifications;
+    uint64_t sendErrors; /**< requests failed to send */
+    uint64_t retries; /**< requests resent */
+    uint64_t coalesced; /**< requests attached to an identical request */
+    uint64_t throttled; /**< requests delayed or rejected by rate limits */
+};
+
+/**
+ * @brief Round trip time estimation of a clock
+ * @details
+ *  Smoothed round trip time and its variation as TCP uses (RFC 6298)
+ */
+struct TransRtt {
+    uint64_t srttUs; /**< smoothed round trip time in microseconds */
+    uint64_t rttvarUs; /**< round trip time variation in microseconds */
+    uint64_t rtoMs; /**< retransmission timeout in milliseconds */
+    uint64_t samples; /**< number of round trip time samples */
+};
+
+/**
+ * @brief Prepared request
+ * @details
+ *  Request message that is built once and sent many times.
+ *  Only the sequence is updated on each send.
+ */
+struct TransFrame {
+    std::vector<uint8_t> frame; /**< message */
+    PortIdentity_t target; /**< target port */
+    mng_vals_e id; /**< management ID */
+    actionField_e action; /**< action */
+};
+
+/**
+ * @brief Asynchronous management requests on a single socket
+ * @details
+ *  Send management requests and match their replies using the
+ *  sequence ID, the target port and the management ID.
+ *  Requests complete when a reply arrives or their deadline passes.
+ *  Thousands of requests can be in flight on a single socket.
+ *  A request to all clocks or to all ports of a clock stays open
+ *  until its deadline and calls the callback for each reply.
+ * @note the engine is not thread safe, use it from a single thread.
+ */
+class TransEngine
+{
+  private:
+    /* Clock, port, management ID, domain and transport specific */
+    typedef std::pair<uint64_t, uint64_t> FlightKey;
+    struct Request {
+        TransCallback callback;
+        PortIdentity_t target;
+        PortIdentity_t self; /* Our port, the target of replies */
+        uint8_t domain;
+        TimerWheel::Handle timer;
+        uint16_t sequence;
+        mng_vals_e id;
+        actionField_e action;
+        bool multi; /* Expect replies from multiple ports */
+        bool cached; /* Reply from the cache */
+        bool leader; /* Identical requests may attach */
+        bool follower; /* Attached to the leader request */
+        bool deferred; /* Waits for the rate limits */
+        bool used;
+        uint16_t leaderSeq;
+        uint32_t replies;
+        uint32_t retries;
+        uint64_t rtoMs; /* Current timeout, doubled on each resend */
+        uint64_t sentUs;
+        /* Kept for resending, or the cached reply */
+        std::vector<uint8_t> frame;
+        std::vector<uint16_t> waiters; /* Sequences of followers */
+        FlightKey flight;
+    };
+    SockBase &m_sock;
+    Message &m_msg; /* Build requests */
+    Message m_rcvMsg; /* Parse replies */
+    Buf m_sendBuf;
+    Buf m_rcvBuf;
+    TimerWheel m_wheel;
+    std::vector<Request> m_reqs; /* Requests slab */
+    std::vector<uint32_t> m_freeReqs;
+    /* Open addressed table of request index by sequence */
+    std::vector<uint32_t> m_table;
+    uint32_t m_tableBits;
+    size_t m_pending;
+    uint16_t m_sequence; /* Next sequence */
+    uint64_t m_timeout; /* Timeout of clock without samples */
+    uint64_t m_minRto;
+    uint64_t m_maxRto;
+    uint32_t m_maxRetries;
+    std::map<uint64_t, TransRtt> m_rtt; /* Key is clock identity */
+    TransCache *m_cache;
+    std::vector<uint16_t> m_hits; /* Sequences of cached replies */
+    bool m_singleFlight;
+    /* Leader sequence of outstanding GET requests */
+    std::map<FlightKey, uint16_t> m_flights;
+    TransNotify m_notify;
+    TokenBucket m_targetLimit; /* Limit of a new target */
+    TokenBucket m_domainLimit; /* Limit of a new domain */
+    TransLimit_e m_limitPolicy;
+    /* Key is clock identity and port number */
+    std::map<std::pair<uint64_t, uint16_t>, TokenBucket> m_targets;
+    std::map<uint8_t, TokenBucket> m_domains;
+    std::vector<uint16_t> m_deferred; /* Sequences of delayed requests */
+    size_t m_completed; /* Completed during process() */
+    bool m_batching;
+    std::vector<const void *> m_batchMsgs;
+    std::vector<size_t> m_batchLens;
+    std::vector<uint32_t> m_batchReqs;
+    TransStats m_stats;
+    uint32_t hash(uint16_t sequence) const;
+    uint32_t find(uint16_t sequence) const;
+    void insert(uint32_t idx);
+    void erase(uint16_t sequence);
+    void grow();
+    FlightKey flightKey(const PortIdentity_t &target, mng_vals_e id) const;
+    bool hasWaiters(const Request &req) const;
+    uint32_t add(const PortIdentity_t &target, actionField_e action,
+        mng_vals_e id, TransCallback callback);
+    uint32_t alloc();
+    void release(uint32_t idx);
+    bool build(const PortIdentity_t *target, actionField_e action,
+        mng_vals_e id, BaseMngTlv *data);
+    int send(const PortIdentity_t *target, actionField_e action,
+        mng_vals_e id, BaseMngTlv *data, TransCallback callback);
+    int hit(const std::vector<uint8_t> &frame, const PortIdentity_t &target,
+        mng_vals_e id, TransCallback callback);
+    int follow(uint16_t leader, const PortIdentity_t &target, mng_vals_e id,
+        TransCallback callback);
+    int post(uint8_t *buf, size_t len, const PortIdentity_t &target,
+        actionField_e action, mng_vals_e id, TransCallback callback,
+        bool batch);
+    bool isLimited() const;
+    bool allow(const PortIdentity_t &target, uint8_t domain, uint64_t now);
+    void arm(uint32_t idx, const uint8_t *buf, size_t len);
+    void sendDeferred();
+    void complete(uint32_t idx, TransStatus_e status, const Message *msg);
+    void expire(uint64_t cookie);
+    void unsolicited(MNG_PARSE_ERROR_e err);
+    void handle(ssize_t cnt);
+    uint64_t rto(const PortIdentity_t &target) const;
+    void sample(const PortIdentity_t &target, uint64_t rttUs);
+
+  public:
+    /**
+     * Constructor
+     * @param[in] sock initialized socket to send and receive
+     * @param[in] msg message object used to build requests
+     * @note the message parameters are used for all requests,
+     *  except the target, that can be set per request.
+     */
+    TransEngine(SockBase &sock, Message &msg);
+    ~TransEngine();
+    /**
+     * Set initial request timeout
+     * @param[in] timeout_ms time to wait for reply in milliseconds
+     * @return true if timeout is updated
+     * @note used for clocks without round trip time samples and
+     *  for requests to multiple clocks or ports.
+     */
+    bool setTimeout(uint64_t timeout_ms);
+    /**
+     * Get initial request timeout
+     * @return time to wait for reply in milliseconds
+     */
+    uint64_t getTimeout() const { return m_timeout; }
+    /**
+     * Set limits of the adaptive timeout
+     * @param[in] min_ms minimum timeout in milliseconds
+     * @param[in] max_ms maximum timeout in milliseconds
+     * @return true if limits are updated
+     */
+    bool setRtoLimits(uint64_t min_ms, uint64_t max_ms);
+    /**
+     * Set number of times a GET request is resent
+     * @param[in] retries maximum number of resends
+     * @note each resend doubles the timeout, up to the maximum timeout.
+     * @note only GET requests to a single port are resent,
+     *  as they are idempotent.
+     */
+    void setRetries(uint32_t retries) { m_maxRetries = retries; }
+    /**
+     * Get number of times a GET request is resent
+     * @return maximum number of resends
+     */
+    uint32_t getRetries() const { return m_maxRetries; }
+    /**
+     * Get round trip time estimation of a clock
+     * @param[in] clock identity
+     * @param[out] rtt estimation
+     * @return true if clock has round trip time samples
+     * @note replies to resent requests are ambiguous and
+     *  are not sampled (Karn's algorithm).
+     */
+    bool getRtt(const ClockIdentity_t &clock, TransRtt &rtt) const;
+    /**
+     * Remove round trip time estimation of all clocks
+     */
+    void clearRtt() { m_rtt.clear(); }
+    /**
+     * Set reply cache
+     * @param[in] cache used for GET requests, null to remove
+     * @note prepared requests do not use the cache.
+     * @note SET and COMMAND requests invalidate the cache of their clock.
+     */
+    void setCache(TransCache *cache) { m_cache = cache; }
+    /**
+     * Get reply cache
+     * @return cache or null if none
+     */
+    TransCache *getCache() const { return m_cache; }
+    /**
+     * Set coalescing of identical GET requests
+     * @param[in] enable coalescing
+     * @note a GET request with the same target, management ID, domain
+     *  and transport specific as an outstanding GET request is not sent.
+     *  It completes with the reply of the outstanding request.
+     * @note prepared requests are not coalesced.
+     */
+    void setSingleFlight(bool enable) { m_singleFlight = enable; }
+    /**
+     * Get coalescing of identical GET requests
+     * @return true if coalescing is enabled
+     */
+    bool getSingleFlight() const { return m_singleFlight; }
+    /**
+     * Set callback of unsolicited messages
+     * @param[in] notify called with responses that do not match a request,
+     *  like events notifications. Null removes the callback.
+     */
+    void setNotify(TransNotify notify) { m_notify = notify; }
+    /**
+     * Set rate limit of each target port
+     * @param[in] rate requests per second, zero removes the limit
+     * @param[in] burst maximum requests sent at once
+     * @return true if limit is updated
+     * @note requests to all clocks or to all ports of a clock
+     *  use the limit of their target address.
+     */
+    bool setTargetLimit(uint64_t rate, uint64_t burst = 1);
+    /**
+     * Set rate limit of each domain
+     * @param[in] rate requests per second, zero removes the limit
+     * @param[in] burst maximum requests sent at once
+     * @return true if limit is updated
+     */
+    bool setDomainLimit(uint64_t rate, uint64_t burst = 1);
+    /**
+     * Set handling of requests above the rate limits
+     * @param[in] policy queue or reject
+     * @note a queued request is sent by process() when the limits allow,
+     *  its deadline starts when it is sent.
+     * @note requests served from the cache or coalesced are not limited.
+     * @note requests also wait for the socket rate limit,
+     *  see SockBase::setRateLimit().
+     * @note resent requests are delayed with both policies.
+     */
+    void setLimitPolicy(TransLimit_e policy) { m_limitPolicy = policy; }
+    /**
+     * Get handling of requests above the rate limits
+     * @return policy
+     */
+    TransLimit_e getLimitPolicy() const { return m_limitPolicy; }
+    /**
+     * Send request to the message target
+     * @param[in] action to perform
+     * @param[in] id management ID
+     * @param[in] callback called on completion
+     * @return sequence of request or negative on failure
+     */
+    int request(actionField_e action, mng_vals_e id, TransCallback callback)
+    { return send(nullptr, action, id, nullptr, callback); }
+    /**
+     * Send request with data to the message target
+     * @param[in] action to perform
+     * @param[in] id management ID
+     * @param[in] data management TLV data
+     * @param[in] callback called on completion
+     * @return sequence of request or negative on failure
+     */
+    int request(actionField_e action, mng_vals_e id, BaseMngTlv &data,
+        TransCallback callback)
+    { return send(nullptr, action, id, &data, callback); }
+    /**
+     * Send request to a target
+     * @param[in] target port
+     * @param[in] action to perform
+     * @param[in] id management ID
+     * @param[in] callback called on completion
+     * @return sequence of request or negative on failure
+     */
+    int request(const PortIdentity_t &target, actionField_e action,
+        mng_vals_e id, TransCallback callback)
+    { return send(&target, action, id, nullptr, callback); }
+    /**
+     * Send request with data to a target
+     * @param[in] target port
+     * @param[in] action to perform
+     * @param[in] id management ID
+     * @param[in] data management TLV data
+     * @param[in] callback called on completion
+     * @return sequence of request or negative on failure
+     */
+    int request(const PortIdentity_t &target, actionField_e action,
+        mng_vals_e id, BaseMngTlv &data, TransCallback callback)
+    { return send(&target, action, id, &data, callback); }
+    /**
+     * Prepare a request
+     * @param[out] frame prepared request
+     * @param[in] target port
+     * @param[in] action to perform
+     * @param[in] id management ID
+     * @return true if request is prepared
+     */
+    bool prepare(TransFrame &frame, const PortIdentity_t &target,
+        actionField_e action, mng_vals_e id);
+    /**
+     * Prepare a request with data
+     * @param[out] frame prepared request
+     * @param[in] target port
+     * @param[in] action to perform
+     * @param[in] id management ID
+     * @param[in] data management TLV data
+     * @return true if request is prepared
+     */
+    bool prepare(TransFrame &frame, const PortIdentity_t &target,
+        actionField_e action, mng_vals_e id, BaseMngTlv &data);
+    /**
+     * Send a prepared request
+     * @param[in, out] frame prepared request, its sequence is updated
+     * @param[in] callback called on completion
+     * @return sequence of request or negative on failure
+     * @note during a batch, the frame should not change
+     *  till the batch is sent.
+     */
+    int request(TransFrame &frame, TransCallback callback);
+    /**
+     * Start a batch of prepared requests
+     * @note prepared requests are sent together by sendBatch()
+     *  using a single system call when the socket supports it.
+     *  Other requests are sent immediately.
+     */
+    void startBatch() { m_batching = true; }
+    /**
+     * Send the batch of prepared requests
+     * @return number of requests sent
+     * @note requests that fail to send complete with send error status.
+     */
+    size_t sendBatch();
+    /**
+     * Cancel a request
+     * @param[in] sequence of request
+     * @return true if request was pending
+     * @note the callback is called with cancel status
+     */
+    bool cancel(uint16_t sequence);
+    /**
+     * Receive replies and handle deadlines
+     * @param[in] timeout_ms maximum time to wait in milliseconds.
+     *  use 0 to wait until a request completes.
+     * @return number of requests completed
+     * @note return without waiting when no request is pending,
+     *  unless a notify callback is set and the timeout is not 0.
+     */
+    size_t process(uint64_t timeout_ms = 0);
+    /**
+     * Process until all requests complete
+     */
+    void run() {
+        while(m_pending > 0)
+            process();
+    }
+    /**
+     * Get number of pending requests
+     * @return number of requests
+     */
+    size_t pending() const { return m_pending; }
+    /**
+     * Get statistics
+     * @return statistics
+     */
+    const TransStats &getStats() const { return m_stats; }
+};
+
+#endif /*__PMC_TRANS_H*/
@@ -0,0 +1,381 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+
+/** @file
+ * @brief AF_XDP socket for PTP over Ethernet
+ *
+ * @author Erez Geva <ErezGeva2@@gmail.com>
+ * @copyright 2021 Erez Geva
+ *
+ */
+
+#include <poll.h>
+#include <cerrno>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/bpf.h>
+#include <linux/if_xdp.h>
+#include "end.h"
+#include "sock.h"
+#include "msg.h"
+
+#ifndef AF_XDP
+#define AF_XDP 44
+#endif
+#ifndef SOL_XDP
+#define SOL_XDP 283
+#endif
+
+const uint32_t xdp_frame_size = 2048; // UMEM chunk size
+const uint32_t xdp_ring_size = 512; // Descriptors in each ring
+// First half of UMEM frames is used for receive, second half for transmit
+const uint32_t xdp_frames = 2 * xdp_ring_size;
+const uint32_t xdp_max_queues = 64; // Size of the XSKMAP
+const int32_t xdp_pass = 2; // XDP_PASS action
+
+// eBPF instruction
+static inline bpf_insn ebpf(uint8_t code, uint8_t dst, uint8_t src,
+    int16_t off, int32_t imm)
+{
+    bpf_insn insn;
+    insn.code = code;
+    insn.dst_reg = dst;
+    insn.src_reg = src;
+    insn.off = off;
+    insn.imm = imm;
+    return insn;
+}
+static inline int sys_bpf(int cmd, bpf_attr &attr)
+{
+    return syscall(__NR_bpf, cmd, &attr, sizeof(attr));
+}
+SockXdp::SockXdp() :
+    m_queue(0),
+    m_zeroCopy(false),
+    m_useZeroCopy(false),
+    m_mapFd(-1),
+    m_progFd(-1),
+    m_linkFd(-1),
+    m_umem(nullptr),
+    m_umemLen(0),
+    m_rx{0},
+    m_tx{0},
+    m_fill{0},
+    m_comp{0},
+    m_hdr{0}
+{
+}
+bool SockXdp::setQueue(uint32_t queue)
+{
+    if(m_isInit || queue >= xdp_max_queues)
+        return false;
+    m_queue = queue;
+    return true;
+}
+bool SockXdp::setZeroCopy(bool zeroCopy)
+{
+    if(m_isInit)
+        return false;
+    m_zeroCopy = zeroCopy;
+    return true;
+}
+bool SockXdp::setAllBase(ConfigFile &cfg, const std::string &section)
+{
+    return setPtpDstMac(cfg, section);
+}
+bool SockXdp::mapRing(XdpRing &ring, const void *offsets, size_t descSize,
+    uint64_t pgoff)
+{
+    const xdp_ring_offset *off = (const xdp_ring_offset *)offsets;
+    ring.mapLen = off->desc + xdp_ring_size * descSize;
+    ring.map = mmap(nullptr, ring.mapLen, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, m_fd, pgoff);
+    if(ring.map == MAP_FAILED) {
+        ring.map = nullptr;
+        return sysErr("mmap XDP ring");
+    }
+    uint8_t *base = (uint8_t *)ring.map;
+    ring.producer = (uint32_t *)(base + off->producer);
+    ring.consumer = (uint32_t *)(base + off->consumer);
+    ring.flags = (uint32_t *)(base + off->flags);
+    ring.ring = base + off->desc;
+    ring.mask = xdp_ring_size - 1;
+    return true;
+}
+void SockXdp::unmapRing(XdpRing &ring)
+{
+    if(ring.map != nullptr)
+        munmap(ring.map, ring.mapLen);
+    ring = {0};
+}
+bool SockXdp::initSock()
+{
+    m_fd = socket(AF_XDP, SOCK_RAW, 0);
+    if(m_fd < 0)
+        return sysErr("socket");
+    m_umemLen = xdp_frames * xdp_frame_size;
+    void *umem = mmap(nullptr, m_umemLen, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(umem == MAP_FAILED)
+        return sysErr("mmap UMEM");
+    m_umem = (uint8_t *)umem;
+    xdp_umem_reg reg = {0};
+    reg.addr = (uint64_t)m_umem;
+    reg.len = m_umemLen;
+    reg.chunk_size = xdp_frame_size;
+    if(setsockopt(m_fd, SOL_XDP, XDP_UMEM_REG, &reg, sizeof(reg)) != 0)
+        return sysErr("XDP_UMEM_REG");
+    const int rings[] = { XDP_UMEM_FILL_RING, XDP_UMEM_COMPLETION_RING,
+            XDP_RX_RING, XDP_TX_RING
+        };
+    for(int opt : rings) {
+        if(setsockopt(m_fd, SOL_XDP, opt, &xdp_ring_size,
+                sizeof(xdp_ring_size)) != 0)
+            return sysErr("XDP ring size");
+    }
+    xdp_mmap_offsets off;
+    socklen_t len = sizeof(off);
+    if(getsockopt(m_fd, SOL_XDP, XDP_MMAP_OFFSETS, &off, &len) != 0)
+        return sysErr("XDP_MMAP_OFFSETS");
+    if(!mapRing(m_rx, &off.rx, sizeof(xdp_desc), XDP_PGOFF_RX_RING) ||
+        !mapRing(m_tx, &off.tx, sizeof(xdp_desc), XDP_PGOFF_TX_RING) ||
+        !mapRing(m_fill, &off.fr, sizeof(uint64_t), XDP_UMEM_PGOFF_FILL_RING) ||
+        !mapRing(m_comp, &off.cr, sizeof(uint64_t),
+            XDP_UMEM_PGOFF_COMPLETION_RING))
+        return false;
+    // Pass the receive frames to kernel
+    uint64_t *fill = (uint64_t *)m_fill.ring;
+    for(uint32_t i = 0; i < xdp_ring_size; i++)
+        fill[i] = i * xdp_frame_size;
+    __atomic_store_n(m_fill.producer, xdp_ring_size, __ATOMIC_RELEASE);
+    // Transmit frames are owned by us till kernel use them
+    m_txFree.clear();
+    m_txFree.reserve(xdp_ring_size);
+    for(uint32_t i = xdp_ring_size; i < xdp_frames; i++)
+        m_txFree.push_back((uint64_t)i * xdp_frame_size);
+    sockaddr_xdp addr = {0};
+    addr.sxdp_family = AF_XDP;
+    addr.sxdp_ifindex = m_ifIndex;
+    addr.sxdp_queue_id = m_queue;
+    m_useZeroCopy = m_zeroCopy;
+    if(m_useZeroCopy) {
+        addr.sxdp_flags = XDP_USE_NEED_WAKEUP | XDP_ZEROCOPY;
+        if(bind(m_fd, (sockaddr *)&addr, sizeof(addr)) == 0)
+            return true;
+        // Fall back to copy mode
+        m_useZeroCopy = false;
+    }
+    addr.sxdp_flags = XDP_USE_NEED_WAKEUP | XDP_COPY;
+    if(bind(m_fd, (sockaddr *)&addr, sizeof(addr)) != 0)
+        return sysErr("bind");
+    return true;
+}
+bool SockXdp::loadProg()
+{
+    bpf_attr attr = {0};
+    attr.map_type = BPF_MAP_TYPE_XSKMAP;
+    attr.key_size = sizeof(uint32_t);
+    attr.value_size = sizeof(uint32_t);
+    attr.max_entries = xdp_max_queues;
+    m_mapFd = sys_bpf(BPF_MAP_CREATE, attr);
+    if(m_mapFd < 0)
+        return sysErr("BPF_MAP_CREATE");
+    /*
+     * Redirect management and signaling frames with ethernet protocol 1588
+     * to the AF_XDP socket that is bound to the receive queue.
+     * Other frames, like event messages, pass to the kernel.
+     * Registers: R1 = context, R6 = saved context.
+     * xdp_md fields: data 0, data_end 4, rx_queue_index 16
+     */
+    const int16_t redirect = 12; // Index of redirect instructions
+    const int16_t pass = 18; // Index of pass instruction
+    const bpf_insn prog[] = {
+        // R6 = R1
+        ebpf(BPF_ALU64 | BPF_MOV | BPF_X, 6, 1, 0, 0),
+        // R2 = data
+        ebpf(BPF_LDX | BPF_MEM | BPF_W, 2, 6, 0, 0),
+        // R3 = data_end
+        ebpf(BPF_LDX | BPF_MEM | BPF_W, 3, 6, 4, 0),
+        // R4 = data + ethernet header + PTP message type
+        ebpf(BPF_ALU64 | BPF_MOV | BPF_X, 4, 2, 0, 0),
+        ebpf(BPF_ALU64 | BPF_ADD | BPF_K, 4, 0, 0, sizeof(ethhdr) + 1),
+        // 5: if R4 > data_end goto pass
+        ebpf(BPF_JMP | BPF_JGT | BPF_X, 4, 3, pass - 6, 0),
+        // R4 = ethernet protocol, in network order
+        ebpf(BPF_LDX | BPF_MEM | BPF_H, 4, 2, 12, 0),
+        // 7: if R4 != 1588 goto pass
+        ebpf(BPF_JMP | BPF_JNE | BPF_K, 4, 0, pass - 8,
+            cpu_to_net16(ETH_P_1588)),
+        // R4 = PTP message type
+        ebpf(BPF_LDX | BPF_MEM | BPF_B, 4, 2, sizeof(ethhdr), 0),
+        ebpf(BPF_ALU64 | BPF_AND | BPF_K, 4, 0, 0, 0xf),
+        // 10: if R4 == Signaling goto redirect
+        ebpf(BPF_JMP | BPF_JEQ | BPF_K, 4, 0, redirect - 11, Signaling),
+        // 11: if R4 != Management goto pass
+        ebpf(BPF_JMP | BPF_JNE | BPF_K, 4, 0, pass - 12, Management),
+        // 12: redirect, R2 = rx_queue_index, the map key
+        ebpf(BPF_LDX | BPF_MEM | BPF_W, 2, 6, 16, 0),
+        // R1 = map, 64 bits immediate load
+        ebpf(BPF_LD | BPF_DW | BPF_IMM, 1, BPF_PSEUDO_MAP_FD, 0, m_mapFd),
+        ebpf(0, 0, 0, 0, 0),
+        // R3 = action when no socket is bound to the queue
+        ebpf(BPF_ALU64 | BPF_MOV | BPF_K, 3, 0, 0, xdp_pass),
+        // R0 = bpf_redirect_map(R1, R2, R3)
+        ebpf(BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_redirect_map),
+        ebpf(BPF_JMP | BPF_EXIT, 0, 0, 0, 0),
+        // 18: pass
+        ebpf(BPF_ALU64 | BPF_MOV | BPF_K, 0, 0, 0, xdp_pass),
+        ebpf(BPF_JMP | BPF_EXIT, 0, 0, 0, 0),
+    };
+    attr = {0};
+    attr.prog_type = BPF_PROG_TYPE_XDP;
+    attr.insn_cnt = sizeof(prog) / sizeof(bpf_insn);
+    attr.insns = (uint64_t)prog;
+    attr.license = (uint64_t)"GPL";
+    m_progFd = sys_bpf(BPF_PROG_LOAD, attr);
+    if(m_progFd < 0)
+        return sysErr("BPF_PROG_LOAD");
+    attr = {0};
+    attr.map_fd = m_mapFd;
+    attr.key = (uint64_t)&m_queue;
+    attr.value = (uint64_t)&m_fd;
+    attr.flags = BPF_ANY;
+    if(sys_bpf(BPF_MAP_UPDATE_ELEM, attr) != 0)
+        return sysErr("BPF_MAP_UPDATE_ELEM");
+    // The link detach the program when closed
+    attr = {0};
+    attr.link_create.prog_fd = m_progFd;
+    attr.link_create.target_ifindex = m_ifIndex;
+    attr.link_create.attach_type = BPF_XDP;
+    m_linkFd = sys_bpf(BPF_LINK_CREATE, attr);
+    if(m_linkFd < 0)
+        return sysErr("BPF_LINK_CREATE");
+    return true;
+}
+bool SockXdp::initBase()
+{
+    if(m_isInit || !m_have_if || m_ptp_dst_mac.empty())
+        return false;
+    SockBase::closeBase();
+    if(!initSock() || !loadProg()) {
+        closeBase();
+        return false;
+    }
+    // TX
+    m_hdr.h_proto = cpu_to_net16(ETH_P_1588);
+    m_ptp_dst_mac.copy(m_hdr.h_dest);
+    m_mac.copy(m_hdr.h_source);
+    m_isInit = true;
+    return true;
+}
+void SockXdp::closeBase()
+{
+    // Detach the XDP program first
+    for(int *fd : {&m_linkFd, &m_progFd, &m_mapFd}) {
+        if(*fd >= 0) {
+            ::close(*fd);
+            *fd = -1;
+        }
+    }
+    unmapRing(m_rx);
+    unmapRing(m_tx);
+    unmapRing(m_fill);
+    unmapRing(m_comp);
+    SockBase::closeBase();
+    if(m_umem != nullptr) {
+        munmap(m_umem, m_umemLen);
+        m_umem = nullptr;
+    }
+    m_txFree.clear();
+    m_isInit = false;
+}
+void SockXdp::reapTx()
+{
+    uint32_t cons = *m_comp.consumer;
+    uint32_t prod = __atomic_load_n(m_comp.producer, __ATOMIC_ACQUIRE);
+    if(cons == prod)
+        return;
+    uint64_t *comp = (uint64_t *)m_comp.ring;
+    for(; cons != prod; cons++)
+        m_txFree.push_back(comp[cons & m_comp.mask]);
+    __atomic_store_n(m_comp.consumer, cons, __ATOMIC_RELEASE);
+}
+bool SockXdp::sendBase(const void *msg, size_t len)
+{
+    if(!m_isInit)
+        return false;
+    size_t frameLen = sizeof(m_hdr) + len;
+    if(frameLen > xdp_frame_size) {
+        m_stats.txErrors++;
+        return setErr(SOCK_ERR_SEND_SIZE, "send", frameLen, xdp_frame_size);
+    }
+    reapTx();
+    uint32_t prod = *m_tx.producer;
+    uint32_t cons = __atomic_load_n(m_tx.consumer, __ATOMIC_ACQUIRE);
+    if(m_txFree.empty() || prod - cons >= xdp_ring_size)
+        return sendFull();
+    uint64_t addr = m_txFree.back();
+    m_txFree.pop_back();
+    memcpy(m_umem + addr, &m_hdr, sizeof(m_hdr));
+    memcpy(m_umem + addr + sizeof(m_hdr), msg, len);
+    xdp_desc *desc = (xdp_desc *)m_tx.ring + (prod & m_tx.mask);
+    desc->addr = addr;
+    desc->len = frameLen;
+    desc->options = 0;
+    __atomic_store_n(m_tx.producer, prod + 1, __ATOMIC_RELEASE);
+    m_stats.txPackets++;
+    // Kick the kernel to transmit
+    if(!(__atomic_load_n(m_tx.flags, __ATOMIC_ACQUIRE) & XDP_RING_NEED_WAKEUP))
+        return true;
+    if(sendto(m_fd, nullptr, 0, MSG_DONTWAIT, nullptr, 0) < 0 &&
+        errno != EAGAIN && errno != EBUSY && errno != ENOBUFS)
+        return sysErr("send");
+    return true;
+}
+void SockXdp::statsBase()
+{
+    xdp_statistics st;
+    socklen_t len = sizeof(st);
+    if(!m_isInit || getsockopt(m_fd, SOL_XDP, XDP_STATISTICS, &st, &len) != 0)
+        return;
+    m_stats.rxDrops = st.rx_dropped + st.rx_ring_full;
+}
+ssize_t SockXdp::rcvBase(void *buf, size_t bufSize, bool block)
+{
+    if(!m_isInit)
+        return -1;
+    for(;;) {
+        uint32_t cons = *m_rx.consumer;
+        uint32_t prod = __atomic_load_n(m_rx.producer, __ATOMIC_ACQUIRE);
+        if(cons != prod)
+            break;
+        if(!block) {
+            errno = EAGAIN;
+            return -1;
+        }
+        pollfd fds = { .fd = m_fd, .events = POLLIN };
+        if(::poll(&fds, 1, -1) < 0) {
+            sysErr("poll");
+            return -1;
+        }
+    }
+    uint32_t cons = *m_rx.consumer;
+    xdp_desc *desc = (xdp_desc *)m_rx.ring + (cons & m_rx.mask);
+    uint64_t addr = desc->addr;
+    ssize_t cnt = 0;
+    if(desc->len > sizeof(ethhdr))
+        cnt = desc->len - sizeof(ethhdr);
+    cnt = rcvReply(cnt, bufSize, block);
+    if(cnt > 0)
+        memcpy(buf, m_umem + addr + sizeof(ethhdr), cnt);
+    else
+        cnt = -1;
+    __atomic_store_n(m_rx.consumer, cons + 1, __ATOMIC_RELEASE);
+    // Return the frame to the kernel
+    uint32_t fprod = *m_fill.producer;
+    ((uint64_t *)m_fill.ring)[fprod & m_fill.mask] = addr;
+    __atomic_store_n(m_fill.producer, fprod + 1, __ATOMIC_RELEASE);
+    if(__atomic_load_n(m_fill.flags, __ATOMIC_ACQUIRE) & XDP_RING_NEED_WAKEUP)
+        recvfrom(m_fd, nullptr, 0, MSG_DONTWAIT, nullptr, nullptr);
+    return cnt;
+}